@@ -0,0 +1,389 @@
+//------------------------------------------------------------------------------
+//
+// memtrace-dispatch
+//
+// preload one of the build variants of memtrace (see memtrace.c), selected
+// at run time
+//
+//   LD_PRELOAD=./libmemtrace-dispatch.so MEMTRACE_VARIANT=<variant> <program>
+//
+// environment variables
+//
+//   MEMTRACE_VARIANT  'counters', 'leaks', 'full' or 'sampling' (default:
+//                    full). The library of the variant is loaded from the
+//                    directory of this library. All other variables are
+//                    interpreted by the variant.
+//
+// A library loaded with dlopen() does not interpose the functions of libc,
+// so this library defines all functions memtrace interposes and forwards
+// them to the variant through function pointers (the variant itself finds
+// libc with RTLD_NEXT). Until the variant is loaded, the allocation
+// functions go to libc directly through its __libc_* aliases (or, for
+// malloc_usable_size, dlsym(RTLD_NEXT)) and the OS-level functions make the
+// system call directly (brk and sbrk fail).
+// Blocks allocated until then are unknown to the variant.
+//
+// If the variant cannot be loaded, the program runs untraced.
+//
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//
+// the allocation functions of glibc under their internal names
+//
+extern void* __libc_malloc(size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+
+typedef struct { int _; } nothrow_t;
+
+//
+// variants and their libraries
+//
+static const char* variants[][2] = {
+	{ "counters", "libmemtrace-counters.so" },
+	{ "leaks",    "libmemtrace-leaks.so" },
+	{ "full",     "libmemtrace.so" },
+	{ "sampling", "libmemtrace-sampling.so" },
+};
+
+#define N_VARIANTS      (sizeof(variants) / sizeof(variants[0]))
+
+//
+// forwarded functions
+//
+enum {
+	F_malloc, F_free, F_calloc, F_realloc, F_reallocarray, F_posix_memalign,
+	F_aligned_alloc, F_memalign, F_valloc, F_pvalloc, F_malloc_usable_size,
+	F__Znwm, F__Znam, F__ZnwmRKSt9nothrow_t, F__ZnamRKSt9nothrow_t,
+	F__ZnwmSt11align_val_t, F__ZnamSt11align_val_t,
+	F__ZnwmSt11align_val_tRKSt9nothrow_t, F__ZnamSt11align_val_tRKSt9nothrow_t,
+	F__ZdlPv, F__ZdaPv, F__ZdlPvm, F__ZdaPvm,
+	F__ZdlPvSt11align_val_t, F__ZdaPvSt11align_val_t,
+	F__ZdlPvmSt11align_val_t, F__ZdaPvmSt11align_val_t,
+	F__ZdlPvRKSt9nothrow_t, F__ZdaPvRKSt9nothrow_t,
+	F__ZdlPvSt11align_val_tRKSt9nothrow_t, F__ZdaPvSt11align_val_tRKSt9nothrow_t,
+	F_mmap, F_mmap64, F_munmap, F_mremap, F_brk, F_sbrk,
+	F_N
+};
+
+static const char* fn_name[F_N] = {
+	"malloc", "free", "calloc", "realloc", "reallocarray", "posix_memalign",
+	"aligned_alloc", "memalign", "valloc", "pvalloc", "malloc_usable_size",
+	"_Znwm", "_Znam", "_ZnwmRKSt9nothrow_t", "_ZnamRKSt9nothrow_t",
+	"_ZnwmSt11align_val_t", "_ZnamSt11align_val_t",
+	"_ZnwmSt11align_val_tRKSt9nothrow_t", "_ZnamSt11align_val_tRKSt9nothrow_t",
+	"_ZdlPv", "_ZdaPv", "_ZdlPvm", "_ZdaPvm",
+	"_ZdlPvSt11align_val_t", "_ZdaPvSt11align_val_t",
+	"_ZdlPvmSt11align_val_t", "_ZdaPvmSt11align_val_t",
+	"_ZdlPvRKSt9nothrow_t", "_ZdaPvRKSt9nothrow_t",
+	"_ZdlPvSt11align_val_tRKSt9nothrow_t", "_ZdaPvSt11align_val_tRKSt9nothrow_t",
+	"mmap", "mmap64", "munmap", "mremap", "brk", "sbrk"
+};
+
+//
+// until the variant is loaded
+//
+static void* boot_reallocarray(void* p, size_t nmemb, size_t size)
+{
+	size_t bytes;
+
+	if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return __libc_realloc(p, bytes);
+}
+
+static int boot_posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+	void* p = __libc_memalign(alignment, size);
+
+	if (p == NULL) return ENOMEM;
+	*memptr = p;
+
+	return 0;
+}
+
+static size_t boot_malloc_usable_size(void* ptr)
+{
+	// libc does not export a __libc_ name for it; dlsym() allocates through
+	// fn[], which still points to libc
+	static size_t (*usable)(void*) = NULL;
+	size_t (*f)(void*) = __atomic_load_n(&usable, __ATOMIC_ACQUIRE);
+
+	if (f == NULL) {
+		if ((f = (size_t (*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size")) == NULL) {
+			return 0;
+		}
+		__atomic_store_n(&usable, f, __ATOMIC_RELEASE);
+	}
+
+	return f(ptr);
+}
+
+static void* boot_new(size_t size)
+{
+	return __libc_malloc(size ? size : 1);
+}
+
+static void* boot_new_nt(size_t size, const nothrow_t* nt)
+{
+	return boot_new(size);
+}
+
+static void* boot_new_al(size_t size, size_t align)
+{
+	return __libc_memalign(align, size ? size : 1);
+}
+
+static void* boot_new_al_nt(size_t size, size_t align, const nothrow_t* nt)
+{
+	return boot_new_al(size, align);
+}
+
+static void boot_delete(void* ptr)
+{
+	__libc_free(ptr);
+}
+
+static void boot_delete_n(void* ptr, size_t n)
+{
+	__libc_free(ptr);
+}
+
+static void boot_delete_n_n(void* ptr, size_t n, size_t m)
+{
+	__libc_free(ptr);
+}
+
+static void boot_delete_nt(void* ptr, const nothrow_t* nt)
+{
+	__libc_free(ptr);
+}
+
+static void boot_delete_n_nt(void* ptr, size_t n, const nothrow_t* nt)
+{
+	__libc_free(ptr);
+}
+
+static void* boot_mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	return (void*)syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+static int boot_munmap(void* addr, size_t len)
+{
+	return (int)syscall(SYS_munmap, addr, len);
+}
+
+static void* boot_mremap(void* old, size_t old_len, size_t len, int flags, void* addr)
+{
+	return (void*)syscall(SYS_mremap, old, old_len, len, flags, addr);
+}
+
+static int boot_brk(void* addr)
+{
+	errno = ENOMEM;
+	return -1;
+}
+
+static void* boot_sbrk(intptr_t incr)
+{
+	errno = ENOMEM;
+	return (void*)-1;
+}
+
+static void* fn[F_N] = {
+	__libc_malloc, __libc_free, __libc_calloc, __libc_realloc,
+	boot_reallocarray, boot_posix_memalign, __libc_memalign, __libc_memalign,
+	__libc_valloc, __libc_pvalloc, boot_malloc_usable_size,
+	boot_new, boot_new, boot_new_nt, boot_new_nt,
+	boot_new_al, boot_new_al, boot_new_al_nt, boot_new_al_nt,
+	boot_delete, boot_delete, boot_delete_n, boot_delete_n,
+	boot_delete_n, boot_delete_n, boot_delete_n_n, boot_delete_n_n,
+	boot_delete_nt, boot_delete_nt, boot_delete_n_nt, boot_delete_n_nt,
+	boot_mmap, boot_mmap, boot_munmap, boot_mremap, boot_brk, boot_sbrk
+};
+
+//
+// load the variant and switch the function pointers to it
+//
+__attribute__((constructor))
+static void dispatch(void)
+{
+	const char* name = getenv("MEMTRACE_VARIANT");
+	char path[PATH_MAX];
+	void* sym[F_N];
+	const char* slash;
+	Dl_info info;
+	void* h;
+	size_t v;
+	int i;
+
+	if (name == NULL) name = "full";
+	for (v = 0; (v < N_VARIANTS) && (strcmp(variants[v][0], name) != 0); v++);
+	if (v == N_VARIANTS) {
+		fprintf(stderr, "memtrace-dispatch: unknown variant '%s', not tracing\n",
+		        name);
+		return;
+	}
+
+	// the variant's library lives next to this one
+	path[0] = '\0';
+	if ((dladdr((void*)dispatch, &info) != 0) && (info.dli_fname != NULL) &&
+	    ((slash = strrchr(info.dli_fname, '/')) != NULL)) {
+		snprintf(path, sizeof(path), "%.*s/", (int)(slash - info.dli_fname),
+		         info.dli_fname);
+	}
+	strncat(path, variants[v][1], sizeof(path) - strlen(path) - 1);
+
+	if ((h = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fprintf(stderr, "memtrace-dispatch: %s, not tracing\n", dlerror());
+		return;
+	}
+
+	for (i = 0; i < F_N; i++) {
+		if ((sym[i] = dlsym(h, fn_name[i])) == NULL) {
+			fprintf(stderr, "memtrace-dispatch: '%s' not found in %s, not tracing\n",
+			        fn_name[i], path);
+			return;
+		}
+	}
+
+	for (i = 0; i < F_N; i++) __atomic_store_n(&fn[i], sym[i], __ATOMIC_RELEASE);
+}
+
+//
+// forwarding functions
+//
+#define CALL(name, type) ((type)__atomic_load_n(&fn[F_##name], __ATOMIC_RELAXED))
+
+void* malloc(size_t size) {
+	return CALL(malloc, void* (*)(size_t))(size);
+}
+
+void free(void* ptr) {
+	CALL(free, void (*)(void*))(ptr);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	return CALL(calloc, void* (*)(size_t, size_t))(nmemb, size);
+}
+
+void* realloc(void* p, size_t size) {
+	return CALL(realloc, void* (*)(void*, size_t))(p, size);
+}
+
+void* reallocarray(void* p, size_t nmemb, size_t size) {
+	return CALL(reallocarray, void* (*)(void*, size_t, size_t))(p, nmemb, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+	return CALL(posix_memalign, int (*)(void**, size_t, size_t))(memptr, alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	return CALL(aligned_alloc, void* (*)(size_t, size_t))(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+	return CALL(memalign, void* (*)(size_t, size_t))(alignment, size);
+}
+
+void* valloc(size_t size) {
+	return CALL(valloc, void* (*)(size_t))(size);
+}
+
+void* pvalloc(size_t size) {
+	return CALL(pvalloc, void* (*)(size_t))(size);
+}
+
+size_t malloc_usable_size(void* ptr) {
+	return CALL(malloc_usable_size, size_t (*)(void*))(ptr);
+}
+
+#define NEW(name, proto, ...) \
+	void* name proto { return CALL(name, void* (*)proto)(__VA_ARGS__); }
+#define DELETE(name, proto, ...) \
+	void name proto { CALL(name, void (*)proto)(__VA_ARGS__); }
+
+NEW(_Znwm, (size_t size), size)
+NEW(_Znam, (size_t size), size)
+NEW(_ZnwmRKSt9nothrow_t, (size_t size, const nothrow_t* nt), size, nt)
+NEW(_ZnamRKSt9nothrow_t, (size_t size, const nothrow_t* nt), size, nt)
+NEW(_ZnwmSt11align_val_t, (size_t size, size_t align), size, align)
+NEW(_ZnamSt11align_val_t, (size_t size, size_t align), size, align)
+NEW(_ZnwmSt11align_val_tRKSt9nothrow_t,
+    (size_t size, size_t align, const nothrow_t* nt), size, align, nt)
+NEW(_ZnamSt11align_val_tRKSt9nothrow_t,
+    (size_t size, size_t align, const nothrow_t* nt), size, align, nt)
+
+DELETE(_ZdlPv, (void* ptr), ptr)
+DELETE(_ZdaPv, (void* ptr), ptr)
+DELETE(_ZdlPvm, (void* ptr, size_t size), ptr, size)
+DELETE(_ZdaPvm, (void* ptr, size_t size), ptr, size)
+DELETE(_ZdlPvSt11align_val_t, (void* ptr, size_t align), ptr, align)
+DELETE(_ZdaPvSt11align_val_t, (void* ptr, size_t align), ptr, align)
+DELETE(_ZdlPvmSt11align_val_t, (void* ptr, size_t size, size_t align),
+       ptr, size, align)
+DELETE(_ZdaPvmSt11align_val_t, (void* ptr, size_t size, size_t align),
+       ptr, size, align)
+DELETE(_ZdlPvRKSt9nothrow_t, (void* ptr, const nothrow_t* nt), ptr, nt)
+DELETE(_ZdaPvRKSt9nothrow_t, (void* ptr, const nothrow_t* nt), ptr, nt)
+DELETE(_ZdlPvSt11align_val_tRKSt9nothrow_t,
+       (void* ptr, size_t align, const nothrow_t* nt), ptr, align, nt)
+DELETE(_ZdaPvSt11align_val_tRKSt9nothrow_t,
+       (void* ptr, size_t align, const nothrow_t* nt), ptr, align, nt)
+
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) {
+	return CALL(mmap, void* (*)(void*, size_t, int, int, int, off_t))
+	       (addr, len, prot, flags, fd, off);
+}
+
+void* mmap64(void* addr, size_t len, int prot, int flags, int fd, off64_t off) {
+	return CALL(mmap64, void* (*)(void*, size_t, int, int, int, off64_t))
+	       (addr, len, prot, flags, fd, off);
+}
+
+int munmap(void* addr, size_t len) {
+	return CALL(munmap, int (*)(void*, size_t))(addr, len);
+}
+
+void* mremap(void* old, size_t old_len, size_t len, int flags, ...) {
+	void* addr = NULL;
+	va_list ap;
+
+	if (flags & MREMAP_FIXED) {
+		va_start(ap, flags);
+		addr = va_arg(ap, void*);
+		va_end(ap);
+	}
+
+	return CALL(mremap, void* (*)(void*, size_t, size_t, int, ...))
+	       (old, old_len, len, flags, addr);
+}
+
+int brk(void* addr) {
+	return CALL(brk, int (*)(void*))(addr);
+}
+
+void* sbrk(intptr_t incr) {
+	return CALL(sbrk, void* (*)(intptr_t))(incr);
+}
@@ -4,163 +4,2676 @@
 //
 // trace calls to the dynamic memory manager
 //
+// interposes malloc, calloc, realloc, reallocarray, free, the aligned
+// allocation functions (posix_memalign, aligned_alloc, memalign, valloc,
+// pvalloc), malloc_usable_size and C++ operator new/delete, and the OS-level
+// calls mmap, mmap64, munmap, mremap, brk and sbrk made by the program (the
+// allocator of libc maps its heap internally, which is not interposable;
+// it is accounted with mallinfo2() at exit)
+//
+// environment variables
+//
+//   MEMTRACE_LOG     'binary' (default): record every call as a binary event
+//                    in MEMTRACE_FILE, written by a background thread
+//                    'compressed': like 'binary', but written as compactly
+//                    encoded chunks (see memcodec.h). Event files can be
+//                    analyzed with tools/memtrace-decode and replayed against
+//                    other allocators with tools/memtrace-replay.
+//                    'text': log every call to stderr (LOG_* macros)
+//   MEMTRACE_FILE    name of the binary event file
+//                    (default: memtrace.<pid>.bin)
+//   MEMTRACE_DEPTH   number of frames recorded per allocation call site
+//                    (default: 1, i.e., only the caller)
+//   MEMTRACE_SITES   number of call sites to report (default: 10)
+//   MEMTRACE_SIZES   number of most frequent request sizes to report
+//                    (default: 10)
+//   MEMTRACE_SAMPLE  sample one allocation every MEMTRACE_SAMPLE bytes on
+//                    average instead of tracing every call (default: 0, off).
+//                    Calls are not logged in sampling mode, and invalid
+//                    frees are not detected: a block missing from the table
+//                    was simply not sampled and goes to libc.
+//   MEMTRACE_TIMELINE  write the live heap over time to this file: Chrome
+//                    trace event JSON if the name ends in '.json', CSV
+//                    otherwise (default: none)
+//   MEMTRACE_TIMELINE_MS  interval between timeline samples (default: 10)
+//   MEMTRACE_RATE    report allocation, free and live-heap growth rates (see
+//                    memrate.h) periodically to this file, or as datagrams
+//                    to the Unix socket <path> if given as 'unix:<path>'
+//                    (default: none)
+//   MEMTRACE_RATE_S  interval between rate reports in seconds (default: 1)
+//   MEMTRACE_SHM     publish live statistics in this file for memtrace-top;
+//                    '1' selects /dev/shm/memtrace.<pid> (default: none).
+//                    The file is removed at exit.
+//   MEMTRACE_SHM_MS  interval between updates of the statistics (default: 100)
+//   MEMTRACE_SNAPSHOT  write a snapshot of the live blocks (see memsnap.h) to
+//                    <prefix>.<pid>.<n>.snap on SIGUSR2; '1' selects the
+//                    prefix 'memtrace' (default: none)
+//   MEMTRACE_SNAPSHOT_CTL  also write a snapshot whenever this file is
+//                    created; the file is removed once the snapshot is written
+//   MEMTRACE_PPROF   write a heap profile for pprof (see memprof.h) to
+//                    <prefix>.<pid>.heap at exit and to <prefix>.<pid>.<n>.heap
+//                    whenever a snapshot is requested (SIGUSR2 or
+//                    MEMTRACE_SNAPSHOT_CTL); '1' selects the prefix
+//                    'memtrace' (default: none). MEMTRACE_DEPTH defaults to
+//                    the maximum depth then.
+//   MEMTRACE_HEATMAP  write a heatmap of the page occupancy of the live
+//                    blocks (see memfrag.h) to <prefix>.<pid>.heat at exit
+//                    and to <prefix>.<pid>.<n>.heat whenever a snapshot is
+//                    requested (SIGUSR2 or MEMTRACE_SNAPSHOT_CTL); '1'
+//                    selects the prefix 'memtrace' (default: none). Not
+//                    written in sampling mode.
+//   MEMTRACE_POOL_ALLOCS  a block freed within this many allocations is
+//                    short-lived when looking for pool candidates
+//                    (default: 64)
+//   MEMTRACE_POOL_US  a block freed within this many microseconds is
+//                    short-lived, too; 0 turns the test off (default: 10)
+//   MEMTRACE_LATENCY  '1': time every call into libc and report latency
+//                    percentiles per call type and size class and the slowest
+//                    calls (default: off). In sampling mode only sampled calls
+//                    are timed.
+//
+// the statistics, non-deallocated blocks and the number of rejected double
+// and illegal frees are reported to stderr at exit in every log mode. In
+// sampling mode the statistics are estimates scaled up from the sampled
+// allocations.
+//
+// build variants
+//
+// the Makefile builds a library per variant from this file. MEMTRACE_VARIANT
+// fixes at compile time what every call pays for:
+//
+//   VARIANT_COUNTERS  counts the calls and allocated bytes per thread and
+//                    nothing else; all environment variables are ignored.
+//                    Every free goes to libc, invalid ones included
+//                    (libmemtrace-counters.so)
+//   VARIANT_LEAKS    counters and the block table: non-deallocated blocks,
+//                    rejected invalid frees (counted, see above), call sites
+//                    and all reports, but no call log and no sampling
+//                    (libmemtrace-leaks.so)
+//   VARIANT_FULL     everything, selected at run time (libmemtrace.so)
+//   VARIANT_SAMPLING the block table of sampled allocations only; the
+//                    sampling interval defaults to SAMPLE_DEFAULT bytes.
+//                    Invalid frees are not detected, as with MEMTRACE_SAMPLE
+//                    (libmemtrace-sampling.so)
+//
+// memtrace-dispatch.c builds a small library that preloads one of them
+// selected by MEMTRACE_VARIANT at run time.
+//
+#define VARIANT_COUNTERS 1
+#define VARIANT_LEAKS   2
+#define VARIANT_FULL    3
+#define VARIANT_SAMPLING 4
+
+#ifndef MEMTRACE_VARIANT
+#define MEMTRACE_VARIANT VARIANT_FULL
+#endif
+
+#define HAVE_TABLE      (MEMTRACE_VARIANT != VARIANT_COUNTERS)
+#define HAVE_LOG        (MEMTRACE_VARIANT == VARIANT_FULL)
+#define HAVE_SAMPLING   ((MEMTRACE_VARIANT == VARIANT_FULL) || \
+                         (MEMTRACE_VARIANT == VARIANT_SAMPLING))
+
 #define _GNU_SOURCE
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <malloc.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include <assert.h>
 #include <memlog.h>
 #include <memlist.h>
+#include <memshard.h>
+#include <memsite.h>
+#include <memhist.h>
+#include <memclock.h>
+#include <memevent.h>
+#include <memtimeline.h>
+#include <memrate.h>
+#include <memboot.h>
+#include <mempool.h>
+#include <memshm.h>
+#include <memsnap.h>
+#include <memprof.h>
+#include <memfrag.h>
+#include <memlat.h>
 
 //
 // function pointers to stdlib's memory management functions
 //
-static void *(*mallocp)(size_t size) = NULL;
-static void (*freep)(void *ptr) = NULL;
-static void *(*callocp)(size_t nmemb, size_t size);
-static void *(*reallocp)(void *ptr, size_t size);
+// they initially point to the boot_* functions below and are set to the
+// functions of libc once by resolve(), so the wrappers call through them
+// without checking. Until then (i.e., while dlsym() itself allocates),
+// blocks are served from the static bootstrap arena (see memboot.h).
+// Arena blocks are never passed to libc. The OS-level functions make the
+// system call directly until then (brk and sbrk fail).
+//
+static void *boot_malloc(size_t size);
+static void boot_free(void *ptr);
+static void *boot_calloc(size_t nmemb, size_t size);
+static void *boot_realloc(void *ptr, size_t size);
+static int boot_posix_memalign(void **memptr, size_t alignment, size_t size);
+static void *boot_memalign(size_t alignment, size_t size);
+static void *boot_valloc(size_t size);
+static size_t boot_malloc_usable_size(void *ptr);
+static void *boot_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
+static int boot_munmap(void *addr, size_t len);
+static void *boot_mremap(void *old, size_t old_len, size_t len, int flags, ...);
+static int boot_brk(void *addr);
+static void *boot_sbrk(intptr_t incr);
+
+static void *(*mallocp)(size_t size) = boot_malloc;
+static void (*freep)(void *ptr) = boot_free;
+static void *(*callocp)(size_t nmemb, size_t size) = boot_calloc;
+static void *(*reallocp)(void *ptr, size_t size) = boot_realloc;
+static int (*posix_memalignp)(void **memptr, size_t alignment, size_t size) = boot_posix_memalign;
+static void *(*aligned_allocp)(size_t alignment, size_t size) = boot_memalign;
+static void *(*memalignp)(size_t alignment, size_t size) = boot_memalign;
+static void *(*vallocp)(size_t size) = boot_valloc;
+static void *(*pvallocp)(size_t size) = boot_valloc;
+static size_t (*malloc_usable_sizep)(void *ptr) = boot_malloc_usable_size;
+static void *(*mmapp)(void *addr, size_t len, int prot, int flags, int fd, off_t off) = boot_mmap;
+static int (*munmapp)(void *addr, size_t len) = boot_munmap;
+static void *(*mremapp)(void *old, size_t old_len, size_t len, int flags, ...) = boot_mremap;
+static int (*brkp)(void *addr) = boot_brk;
+static void *(*sbrkp)(intptr_t incr) = boot_sbrk;
+
+static int resolving = 0;
+static bool resolved = false;
+
+//
+// resolve the functions of libc; returns false if they are not available
+// yet because resolve() is running (in this or another thread)
+//
+static bool resolve(void)
+{
+	int idle = 0;
+	void* sym[15];
+	const char* name[15] = {
+		"malloc", "free", "calloc", "realloc", "posix_memalign",
+		"aligned_alloc", "memalign", "valloc", "pvalloc", "malloc_usable_size",
+		"mmap", "munmap", "mremap", "brk", "sbrk"
+	};
+	int i;
+
+	if (__atomic_load_n(&resolved, __ATOMIC_ACQUIRE)) return true;
+	if (!__atomic_compare_exchange_n(&resolving, &idle, 1, 0, __ATOMIC_ACQUIRE,
+	                                 __ATOMIC_RELAXED)) return false;
+
+	for (i = 0; i < 15; i++) {
+		if ((sym[i] = dlsym(RTLD_NEXT, name[i])) == NULL) {
+			fprintf(stderr, "Error getting symbol '%s'\n", name[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	mallocp = sym[0];
+	freep = sym[1];
+	callocp = sym[2];
+	reallocp = sym[3];
+	posix_memalignp = sym[4];
+	aligned_allocp = sym[5];
+	memalignp = sym[6];
+	vallocp = sym[7];
+	pvallocp = sym[8];
+	malloc_usable_sizep = sym[9];
+	mmapp = sym[10];
+	munmapp = sym[11];
+	mremapp = sym[12];
+	brkp = sym[13];
+	sbrkp = sym[14];
+
+	__atomic_store_n(&resolved, true, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void* boot_malloc(size_t size)
+{
+	return resolve() ? mallocp(size) : boot_alloc(size, 0);
+}
+
+static void boot_free(void* ptr)
+{
+	if (resolve()) freep(ptr);
+}
+
+static void* boot_calloc(size_t nmemb, size_t size)
+{
+	size_t bytes;
+
+	if (resolve()) return callocp(nmemb, size);
+	if (__builtin_mul_overflow(nmemb, size, &bytes)) return NULL;
+
+	// the arena is never reused, so its blocks are zero
+	return boot_alloc(bytes, 0);
+}
+
+static void* boot_realloc(void* ptr, size_t size)
+{
+	void* res;
+
+	if (resolve()) return reallocp(ptr, size);
+
+	res = boot_alloc(size, 0);
+	if ((res != NULL) && (ptr != NULL)) {
+		memcpy(res, ptr, boot_size(ptr) < size ? boot_size(ptr) : size);
+	}
+
+	return res;
+}
+
+static int boot_posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+	if (resolve()) return posix_memalignp(memptr, alignment, size);
+
+	*memptr = boot_alloc(size, alignment);
+	return *memptr != NULL ? 0 : ENOMEM;
+}
+
+static void* boot_memalign(size_t alignment, size_t size)
+{
+	if (resolve()) return memalignp(alignment, size);
+	return boot_alloc(size, alignment);
+}
+
+static void* boot_valloc(size_t size)
+{
+	if (resolve()) return vallocp(size);
+	return boot_alloc(size, 4096);
+}
+
+static size_t boot_malloc_usable_size(void* ptr)
+{
+	if (resolve()) return malloc_usable_sizep(ptr);
+	return ptr != NULL ? boot_size(ptr) : 0;
+}
+
+static void* boot_mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	if (resolve()) return mmapp(addr, len, prot, flags, fd, off);
+	return (void*)syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+static int boot_munmap(void* addr, size_t len)
+{
+	if (resolve()) return munmapp(addr, len);
+	return (int)syscall(SYS_munmap, addr, len);
+}
+
+static void* boot_mremap(void* old, size_t old_len, size_t len, int flags, ...)
+{
+	va_list ap;
+	void* new;
+
+	va_start(ap, flags);
+	new = (flags & MREMAP_FIXED) ? va_arg(ap, void*) : NULL;
+	va_end(ap);
+
+	if (resolve()) return mremapp(old, old_len, len, flags, new);
+	return (void*)syscall(SYS_mremap, old, old_len, len, flags, new);
+}
+
+static int boot_brk(void* addr)
+{
+	if (resolve()) return brkp(addr);
+	errno = ENOMEM;
+	return -1;
+}
+
+static void* boot_sbrk(intptr_t incr)
+{
+	if (resolve()) return sbrkp(incr);
+	errno = ENOMEM;
+	return (void*)-1;
+}
 
 //
 // statistics & other global variables
 //
-static unsigned long n_malloc  = 0;
-static unsigned long n_calloc  = 0;
-static unsigned long n_realloc = 0;
-static unsigned long n_allocb  = 0;
-static unsigned long n_freeb   = 0;
-static item *list = NULL;
+// statistics and the block table are kept per thread (see memshard.h) and
+// merged in fini(). busy is set while the tracer itself runs so that
+// allocations made by the tracer (or by libc on its behalf) are not traced.
+//
+static bool ready = false;
+static __thread int busy __attribute__((tls_model("initial-exec"))) = 0;
 
 //
-// init - this function is called once when the shared library is loaded
+// logging mode and background thread (the agent) draining the event rings,
+// taking the peak of the live heap and sampling the timeline. The agent runs
+// in every mode.
 //
-__attribute__((constructor))
-void init(void)
+#define MODE_TEXT       0
+#define MODE_BINARY     1
+#define MODE_OFF        2
+
+#define AGENT_IDLE_NS   1000000L          // sleep when there was nothing to do
+#define AGENT_CLOCK_NS  1000000000UL      // interval of calibration events
+
+static int mode = HAVE_LOG ? MODE_BINARY : MODE_OFF;
+static int depth = 1;
+static int n_sites = 10;
+static int n_sizes = 10;
+static pthread_t agent_tid;
+static bool agent_running = false;
+static bool agent_stop = false;
+
+//
+// sampling
+//
+// like the heap profiler of tcmalloc, the allocated bytes of each thread are
+// counted down from an exponentially distributed interval with mean sample.
+// The allocation that reaches zero is sampled and a new interval is drawn;
+// all other allocations only update the countdown. A block of size bytes is
+// sampled with probability p = 1 - exp(-size/sample), so a sampled block
+// stands for 1/p blocks and size/p bytes.
+//
+// A free() must not look up unsampled blocks in the block tables. filter
+// counts the sampled live blocks per hash of their address; blocks whose
+// counter is zero were not sampled and go straight to libc.
+//
+#define FILTER_BITS     16
+#define SAMPLE_DEFAULT  (512 * 1024)
+
+#if HAVE_SAMPLING
+static unsigned long sample = 0;
+#else
+static const unsigned long sample = 0;
+#endif
+static unsigned int filter[1 << FILTER_BITS];
+static __thread long sample_left __attribute__((tls_model("initial-exec"))) = 0;
+static __thread bool sample_armed __attribute__((tls_model("initial-exec"))) = false;
+
+//
+// block lifetimes
+//
+// the lifetime of a block is measured in allocations (the number of blocks
+// allocated in the shard of the allocating thread between its allocation and
+// its deallocation) and in ticks. Blocks of at most SHORT_SIZE bytes that are
+// freed within SHORT_ALLOCS allocations are reported as short-lived.
+//
+// Each shard counts its own allocations (shard->seq), so the traced threads
+// do not contend on a global counter. An item's seq holds the shard id above
+// SEQ_SHIFT and the shard's count below, so that a thread freeing another
+// thread's block can read the clock of the right shard.
+//
+// In sampling mode only sampled allocations advance the count (by their
+// weight), so lifetimes in allocations have a resolution of about one
+// sampling interval.
+//
+#define SHORT_SIZE      256
+#define SHORT_ALLOCS    16
+
+#define SEQ_SHIFT       48
+#define SEQ_MASK        ((1UL << SEQ_SHIFT) - 1)
+
+//
+// pool candidates
+//
+// a call site with at least POOL_MIN short-lived blocks whose blocks are
+// mostly (POOL_SHARE percent of the freed blocks) short-lived and of nearly
+// the same size (the largest at most POOL_SLACK percent larger than the
+// smallest) could allocate from a freelist or an arena instead. A block is
+// short-lived if it is freed within pool_allocs allocations or pool_us
+// microseconds.
+//
+// pool_us is converted to ticks once the clock can be calibrated without
+// waiting (POOL_CALIBRATE_NS after startup); until then only the test in
+// allocations applies.
+//
+#define POOL_ALLOCS     64
+#define POOL_US         10
+#define POOL_MIN        16
+#define POOL_SHARE      80.0
+#define POOL_SLACK      25
+#define POOL_CALIBRATE_NS 10000000ULL
+
+static unsigned long pool_allocs = POOL_ALLOCS;
+static unsigned long pool_us = POOL_US;
+static uint64_t pool_ticks = 0;
+
+//
+// allocator latency
+//
+// the wrappers read the time stamp counter before and after calling into
+// libc. lat_start() returns 0 if latencies are not measured, and a start
+// time of 0 tells the tracing functions that the call was not timed.
+//
+#if HAVE_TABLE
+static bool timing = false;
+#else
+static const bool timing = false;
+#endif
+
+static const char* op_name[LAT_OPS] = {
+	"", "malloc", "calloc", "realloc", "free", "memalign", "operator new",
+	"operator delete"
+};
+
+static inline uint64_t lat_start(void)
 {
-	char *error;
+	return timing ? clock_ticks() : 0;
+}
 
-	LOG_START();
+//
+// live heap
+//
+// every shard keeps the live heap of the blocks it allocated (see
+// memshard.h), so the traced calls do not contend on global counters.
+// live_sum() adds them up; update_peak() raises peak_bytes/peak_blocks to the
+// sum and to the peaks of the single shards. The agent calls it on every
+// tick, fini() once more. A shard's live heap never exceeds the total, so
+// the peak is exact for a single thread; with several threads it may miss
+// spikes shorter than a tick. peak_tsc is the time stamp of the peak.
+//
+static unsigned long peak_bytes = 0;
+static unsigned long peak_blocks = 0;
+static uint64_t peak_tsc = 0;
+static uint64_t start_tsc = 0;
+static uint64_t start_ns = 0;
+
+//
+// OS-level memory
+//
+// map_bytes is the memory the program currently has mapped with mmap and
+// mremap (whole pages), brk_bytes the memory it added to the heap with brk
+// and sbrk. The mappings of libc's allocator are not seen here. Unmapping
+// regions mapped before the tracer was loaded does not take map_bytes below
+// zero.
+//
+static unsigned long map_bytes = 0;
+static unsigned long map_peak = 0;
+static long brk_bytes = 0;
+static unsigned long n_os[EV_SBRK - EV_MMAP + 1];
+static size_t page_size = 4096;
+
+static bool timeline = false;
+static uint64_t timeline_ns = 10000000UL;
+
+//
+// allocation-rate reports (see memrate.h), written by the agent from the
+// counters of the shards; the traced calls do not take part
+//
+static bool rates = false;
+static uint64_t rate_ns = 1000000000UL;
+
+//
+// live statistics in shared memory (see memshm.h), updated by the agent
+//
+static shm_stats* shm = NULL;
+static char shm_path[256];
+static uint64_t shm_ns = 100000000UL;
+
+//
+// heap snapshots, profiles and heatmaps
+//
+// the SIGUSR2 handler only sets snap_requested; the agent writes the
+// snapshot, profile and/or heatmap. The control file is polled every
+// SNAP_POLL_NS.
+//
+#define SNAP_POLL_NS    100000000UL
+
+static const char* snap_prefix = NULL;
+static const char* prof_prefix = NULL;
+static const char* heat_prefix = NULL;
+static const char* snap_ctl = NULL;
+static volatile sig_atomic_t snap_requested = 0;
+static int snap_count = 0;
+
+static inline bool raise_max(unsigned long* max, unsigned long v)
+{
+	unsigned long m = __atomic_load_n(max, __ATOMIC_RELAXED);
 
-	// initialize a new list to keep track of all memory (de-)allocations
-	// (not needed for part 1)
-	list = new_list();
+	while (v > m) {
+		if (__atomic_compare_exchange_n(max, &m, v, 1, __ATOMIC_RELAXED,
+		                                __ATOMIC_RELAXED)) return true;
+	}
 
-	// ...
+	return false;
 }
 
 //
-// fini - this function is called once when the shared library is unloaded
+// the shard that allocated a block (see SEQ_SHIFT) or NULL
 //
-__attribute__((destructor))
-void fini(void)
+//   s          shard of the calling thread
+//
+static shard* owner_of(shard* s, const item* node)
 {
-	long n_alloc_total = n_malloc + n_calloc + n_realloc;
-	long avg_allocb = n_allocb / n_alloc_total;
-	item* node = list;
-	bool found = false;
+	int id = (int)(node->seq >> SEQ_SHIFT);
+	shard* o;
 
-	LOG_STATISTICS(n_allocb, avg_allocb, n_freeb);
+	if (id == s->id) return s;
+	for (o = shard_first(); (o != NULL) && (o->id != id); o = o->next);
 
-	while ((node = node->next) != NULL) {
-		if (node->cnt > 0) {
-			if (!found) {
-				LOG_NONFREED_START();
-				found = true;
-			}
-			LOG_BLOCK(node->ptr, node->size, node->cnt);
+	return o;
+}
+
+//
+// add n blocks of a total of bytes bytes to the live heap of shard o
+// (negative to remove them)
+//
+//   s          shard of the calling thread
+//
+// only the owner of o adds blocks; blocks freed by another thread are
+// counted in o's remote counters
+//
+static void live_add(shard* s, shard* o, long n, long bytes, uint64_t tsc)
+{
+	unsigned long b, k;
+
+	if (o == NULL) return;
+	if (o != s) {
+		__atomic_fetch_add(&o->remote_bytes, -bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&o->remote_blocks, -n, __ATOMIC_RELAXED);
+		return;
+	}
+
+	b = s->live_bytes + bytes;
+	k = s->live_blocks + n;
+	__atomic_store_n(&s->live_bytes, b, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->live_blocks, k, __ATOMIC_RELAXED);
+
+	if (n <= 0) return;
+
+	b -= __atomic_load_n(&s->remote_bytes, __ATOMIC_RELAXED);
+	k -= __atomic_load_n(&s->remote_blocks, __ATOMIC_RELAXED);
+	if (b > s->peak_bytes) {
+		__atomic_store_n(&s->peak_bytes, b, __ATOMIC_RELAXED);
+		__atomic_store_n(&s->peak_tsc, tsc, __ATOMIC_RELAXED);
+	}
+	if (k > s->peak_blocks) __atomic_store_n(&s->peak_blocks, k, __ATOMIC_RELAXED);
+}
+
+//
+// sum up the live heaps of all shards
+//
+static void live_sum(unsigned long* bytes, unsigned long* blocks)
+{
+	shard* s;
+
+	*bytes = 0;
+	*blocks = 0;
+	for (s = shard_first(); s != NULL; s = s->next) {
+		*bytes += __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED) -
+		          __atomic_load_n(&s->remote_bytes, __ATOMIC_RELAXED);
+		*blocks += __atomic_load_n(&s->live_blocks, __ATOMIC_RELAXED) -
+		           __atomic_load_n(&s->remote_blocks, __ATOMIC_RELAXED);
+	}
+
+	// the counters of different shards are read at slightly different times
+	if ((long)*bytes < 0) *bytes = 0;
+	if ((long)*blocks < 0) *blocks = 0;
+}
+
+//
+// raise the peak to the current live heap and to the peaks of the shards;
+// called by one thread at a time (the agent, then fini())
+//
+static void update_peak(void)
+{
+	unsigned long bytes, blocks;
+	shard* s;
+
+	live_sum(&bytes, &blocks);
+	if (bytes > peak_bytes) {
+		peak_bytes = bytes;
+		peak_tsc = clock_ticks();
+	}
+	if (blocks > peak_blocks) peak_blocks = blocks;
+
+	for (s = shard_first(); s != NULL; s = s->next) {
+		bytes = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+		if (bytes > peak_bytes) {
+			peak_bytes = bytes;
+			peak_tsc = __atomic_load_n(&s->peak_tsc, __ATOMIC_RELAXED);
 		}
+		blocks = __atomic_load_n(&s->peak_blocks, __ATOMIC_RELAXED);
+		if (blocks > peak_blocks) peak_blocks = blocks;
 	}
+}
 
-	LOG_STOP();
+static void sample_timeline(void)
+{
+	unsigned long bytes, blocks;
 
-	// free list (not needed for part 1)
-	free_list(list);
+	live_sum(&bytes, &blocks);
+	timeline_sample(clock_mono_ns() - start_ns, bytes, blocks, peak_bytes);
 }
 
-// ...
+static void report_rates(void)
+{
+	rate_sample r;
+	stats st;
 
-void* malloc(size_t size) {
-	void* ptr;
+	shard_stats(&st);
+	r.ns = clock_mono_ns() - start_ns;
+	r.allocs = st.n_malloc + st.n_calloc + st.n_realloc + st.n_memalign + st.n_new;
+	r.alloc_bytes = st.n_allocb;
+	r.frees = st.n_free;
+	r.free_bytes = st.n_freeb;
+	live_sum(&r.live_bytes, &r.live_blocks);
+
+	rate_report(&r);
+}
+
+static void publish_stats(bool done)
+{
+	shm_stats snap;
+
+	shard_stats(&snap.st);
+	snap.done = done;
+	snap.ns = clock_mono_ns() - start_ns;
+	snap.sample = sample;
+	live_sum(&snap.live_bytes, &snap.live_blocks);
+	snap.peak_bytes = peak_bytes;
+	snap.peak_blocks = peak_blocks;
 
-	// Get address of libc malloc
-	if (!mallocp) {
-		mallocp = dlsym(RTLD_NEXT, "malloc");
+	shm_publish(shm, &snap);
+}
+
+static void profile(const char* path)
+{
+	if (prof_write(path) != 0) {
+		fprintf(stderr, "Error writing memtrace heap profile '%s'\n", path);
+	} else {
+		fprintf(stderr, "memtrace: heap profile written to '%s'\n", path);
 	}
+}
 
-	ptr = mallocp(size);
-	LOG_MALLOC(size, ptr);
-	
-	n_malloc++;
-	n_allocb += size;
+static void heatmap(const char* path, frag* f)
+{
+	frag* own = f ? NULL : (f = frag_scan());
 
-	alloc(list, ptr, size);
+	if ((f == NULL) || (frag_write(f, path, clock_mono_ns() - start_ns) != 0)) {
+		fprintf(stderr, "Error writing memtrace heatmap '%s'\n", path);
+	} else {
+		fprintf(stderr, "memtrace: heatmap written to '%s'\n", path);
+	}
 
-	return ptr;
+	frag_free(own);
 }
 
-void free(void* ptr) {
-	item* node;
+static void snapshot(void)
+{
+	char path[PATH_MAX];
 
-	LOG_FREE(ptr);
+	if (snap_prefix != NULL) {
+		snprintf(path, sizeof(path), "%s.%d.%d.snap", snap_prefix,
+		         (int)getpid(), snap_count);
 
-	// validity check
-	node = find(list, ptr);
-	if (node == NULL) {
-		LOG_ILL_FREE();
-		return;
+		if (snap_write(path, clock_mono_ns() - start_ns) != 0) {
+			fprintf(stderr, "Error writing memtrace snapshot '%s'\n", path);
+		} else {
+			fprintf(stderr, "memtrace: snapshot written to '%s'\n", path);
+		}
+	}
+
+	if (prof_prefix != NULL) {
+		snprintf(path, sizeof(path), "%s.%d.%d.heap", prof_prefix,
+		         (int)getpid(), snap_count);
+		profile(path);
 	}
-	if (node->cnt == 0) {
-		LOG_DOUBLE_FREE();
+
+	if ((heat_prefix != NULL) && (sample == 0)) {
+		snprintf(path, sizeof(path), "%s.%d.%d.heat", heat_prefix,
+		         (int)getpid(), snap_count);
+		heatmap(path, NULL);
+	}
+
+	snap_count++;
+}
+
+static void* agent(void* arg)
+{
+	struct timespec idle = { 0, AGENT_IDLE_NS };
+	uint64_t next_clock = clock_mono_ns() + AGENT_CLOCK_NS;
+	uint64_t next_sample = clock_mono_ns();
+	uint64_t next_publish = clock_mono_ns();
+	uint64_t next_rate = clock_mono_ns();
+	uint64_t next_poll = clock_mono_ns();
+	uint64_t now;
+
+	// nothing this thread allocates is traced
+	busy = 1;
+
+	while (!__atomic_load_n(&agent_stop, __ATOMIC_ACQUIRE)) {
+		if (event_drain() == 0) nanosleep(&idle, NULL);
+		update_peak();
+
+		now = clock_mono_ns();
+		if (now >= next_clock) {
+			event_clock();
+			next_clock = now + AGENT_CLOCK_NS;
+		}
+		if (timeline && (now >= next_sample)) {
+			sample_timeline();
+			next_sample += timeline_ns;
+			if (next_sample < now) next_sample = now + timeline_ns;
+		}
+		if (rates && (now >= next_rate)) {
+			report_rates();
+			next_rate += rate_ns;
+			if (next_rate < now) next_rate = now + rate_ns;
+		}
+		if ((shm != NULL) && (now >= next_publish)) {
+			publish_stats(false);
+			next_publish = now + shm_ns;
+		}
+		if ((snap_ctl != NULL) && (now >= next_poll)) {
+			if (unlink(snap_ctl) == 0) snap_requested = 1;
+			next_poll = now + SNAP_POLL_NS;
+		}
+		if (((snap_prefix != NULL) || (prof_prefix != NULL) ||
+		     (heat_prefix != NULL)) && snap_requested) {
+			snap_requested = 0;
+			snapshot();
+		}
+	}
+
+	return NULL;
+}
+
+//
+// the child of a fork() has no agent thread; stop recording events, the
+// timeline and the shared statistics there. The file belongs to the parent.
+//
+static void atfork_child(void)
+{
+	agent_running = false;
+	event_detach();
+	timeline_detach();
+	timeline = false;
+	rate_detach();
+	rates = false;
+	shm_unmap(shm);
+	shm = NULL;
+}
+
+static void start_binary(bool chunked)
+{
+	char path[64];
+	const char* file = getenv("MEMTRACE_FILE");
+
+	if (file == NULL) {
+		snprintf(path, sizeof(path), "memtrace.%d.bin", (int)getpid());
+		file = path;
+	}
+
+	if (event_open(file, chunked) != 0) {
+		fprintf(stderr, "Error opening memtrace event file '%s', "
+		        "logging as text\n", file);
+		mode = MODE_TEXT;
 		return;
 	}
+}
+
+static void start_timeline(void)
+{
+	const char* file = getenv("MEMTRACE_TIMELINE");
+	const char* env;
+
+	if (file == NULL) return;
+
+	if ((env = getenv("MEMTRACE_TIMELINE_MS")) != NULL) {
+		timeline_ns = strtoul(env, NULL, 0) * 1000000UL;
+		if (timeline_ns == 0) timeline_ns = 1000000UL;
+	}
 
-	if (!freep) {
-		freep = dlsym(RTLD_NEXT, "free");
+	if (timeline_open(file) != 0) {
+		fprintf(stderr, "Error opening memtrace timeline '%s'\n", file);
+		return;
 	}
+	timeline = true;
+}
 
-	freep(ptr);
+static void start_rates(void)
+{
+	const char* target = getenv("MEMTRACE_RATE");
+	const char* env;
+
+	if ((target == NULL) || (*target == '\0')) return;
+
+	if ((env = getenv("MEMTRACE_RATE_S")) != NULL) {
+		rate_ns = strtoul(env, NULL, 0) * 1000000000UL;
+		if (rate_ns == 0) rate_ns = 1000000000UL;
+	}
 
-	node = dealloc(list, ptr);
-	n_freeb += node->size;
+	if (rate_open(target) != 0) {
+		fprintf(stderr, "Error opening memtrace rate reports '%s'\n", target);
+		return;
+	}
+	rates = true;
 }
 
-void* calloc(size_t count, size_t size) {
-	void* ptr;
+static void start_shm(void)
+{
+	const char* file = getenv("MEMTRACE_SHM");
+	const char* env;
+
+	if ((file == NULL) || (*file == '\0')) return;
 
-	if (!callocp) {
-		callocp = dlsym(RTLD_NEXT, "calloc");
+	if ((env = getenv("MEMTRACE_SHM_MS")) != NULL) {
+		shm_ns = strtoul(env, NULL, 0) * 1000000UL;
+		if (shm_ns == 0) shm_ns = 1000000UL;
 	}
 
-	ptr = callocp(count, size);
-	LOG_CALLOC(count, size, ptr);
+	if (strcmp(file, "1") == 0) {
+		snprintf(shm_path, sizeof(shm_path), "/dev/shm/memtrace.%d", (int)getpid());
+	} else {
+		snprintf(shm_path, sizeof(shm_path), "%s", file);
+	}
 
-	n_calloc++;
-	n_allocb += size;
+	if ((shm = shm_create(shm_path)) == NULL) {
+		fprintf(stderr, "Error creating memtrace statistics '%s'\n", shm_path);
+	}
+}
 
-	alloc(list, ptr, count*size);
+static void stop_shm(void)
+{
+	if (shm == NULL) return;
 
-	return ptr;
+	unlink(shm_path);
+	shm_unmap(shm);
+	shm = NULL;
 }
 
-void* realloc(void* p, size_t size) {
-	void* ptr;
-	item* node;
+static void snap_signal(int sig)
+{
+	snap_requested = 1;
+}
+
+static void start_snapshots(void)
+{
+	struct sigaction sa;
 
-	if (!reallocp) {
-		reallocp = dlsym(RTLD_NEXT, "realloc");
+	snap_prefix = getenv("MEMTRACE_SNAPSHOT");
+	if ((snap_prefix != NULL) && (*snap_prefix == '\0')) snap_prefix = NULL;
+	if ((snap_prefix != NULL) && (strcmp(snap_prefix, "1") == 0)) {
+		snap_prefix = "memtrace";
 	}
 
-	ptr = reallocp(p, size);
-	LOG_REALLOC(p, size, ptr);
+	prof_prefix = getenv("MEMTRACE_PPROF");
+	if ((prof_prefix != NULL) && (*prof_prefix == '\0')) prof_prefix = NULL;
+	if ((prof_prefix != NULL) && (strcmp(prof_prefix, "1") == 0)) {
+		prof_prefix = "memtrace";
+	}
 
-	n_realloc++;
-	n_allocb += size;
+	heat_prefix = getenv("MEMTRACE_HEATMAP");
+	if ((heat_prefix != NULL) && (*heat_prefix == '\0')) heat_prefix = NULL;
+	if ((heat_prefix != NULL) && (strcmp(heat_prefix, "1") == 0)) {
+		heat_prefix = "memtrace";
+	}
 
-	node = dealloc(list, p);
-	n_freeb += node->size;
-	
-	alloc(list, ptr, size);
+	if ((snap_prefix == NULL) && (prof_prefix == NULL) && (heat_prefix == NULL)) {
+		return;
+	}
+
+	snap_ctl = getenv("MEMTRACE_SNAPSHOT_CTL");
+	if ((snap_ctl != NULL) && (*snap_ctl == '\0')) snap_ctl = NULL;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = snap_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+static void start_agent(void)
+{
+	if (pthread_create(&agent_tid, NULL, agent, NULL) != 0) {
+		fprintf(stderr, "Error starting memtrace writer thread%s\n",
+		        mode == MODE_BINARY ? ", logging as text" : "");
+		if (mode == MODE_BINARY) {
+			event_close();
+			mode = MODE_TEXT;
+		}
+		timeline_close();
+		timeline = false;
+		rate_close();
+		rates = false;
+		stop_shm();
+
+		// snapshots, profiles and heatmaps are requested through the agent
+		if ((snap_prefix != NULL) || (prof_prefix != NULL) || (heat_prefix != NULL)) {
+			fprintf(stderr, "memtrace: no snapshots, heap profiles or heatmaps\n");
+		}
+		snap_prefix = NULL;
+		prof_prefix = NULL;
+		heat_prefix = NULL;
+		snap_ctl = NULL;
+		return;
+	}
+	agent_running = true;
+
+	pthread_atfork(NULL, NULL, atfork_child);
+}
+
+static void stop_agent(void)
+{
+	if (agent_running) {
+		__atomic_store_n(&agent_stop, true, __ATOMIC_RELEASE);
+		pthread_join(agent_tid, NULL);
+		agent_running = false;
+	}
+
+	event_close();
+	update_peak();
+
+	if (timeline) {
+		sample_timeline();
+		timeline_close();
+	}
+
+	if (rates) {
+		report_rates();
+		rate_close();
+		rates = false;
+	}
+
+	// readers that still have the file mapped see the final values
+	if (shm != NULL) {
+		publish_stats(true);
+		stop_shm();
+	}
+}
+
+//
+// init - this function is called once when the shared library is loaded
+//
+__attribute__((constructor))
+void init(void)
+{
+	const char* log = getenv("MEMTRACE_LOG");
+	const char* env;
+
+	busy = 1;
+
+	resolve();
+
+	LOG_START();
+
+	clock_init();
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	start_tsc = clock_ticks();
+	start_ns = clock_mono_ns();
+
+	// initialize the per-thread shards that keep track of all memory
+	// (de-)allocations
+	if (shard_init() != 0) {
+		fprintf(stderr, "Error initializing memtrace shards\n");
+		busy = 0;
+		return;
+	}
+
+	if (!HAVE_TABLE) {
+		ready = true;
+		busy = 0;
+		return;
+	}
+
+#if HAVE_SAMPLING
+	if (MEMTRACE_VARIANT == VARIANT_SAMPLING) sample = SAMPLE_DEFAULT;
+	if ((env = getenv("MEMTRACE_SAMPLE")) != NULL) sample = strtoul(env, NULL, 0);
+#endif
+#if HAVE_TABLE
+	if ((env = getenv("MEMTRACE_LATENCY")) != NULL) timing = atoi(env) != 0;
+#endif
+
+	if (HAVE_LOG && (log != NULL) && (strcmp(log, "text") == 0)) mode = MODE_TEXT;
+	if (sample > 0) mode = MODE_OFF;
+	if (mode == MODE_BINARY) {
+		start_binary((log != NULL) && (strcmp(log, "compressed") == 0));
+	}
+	start_timeline();
+	start_rates();
+	start_shm();
+	start_snapshots();
+	start_agent();
+
+	if (prof_prefix != NULL) depth = SITE_MAX_DEPTH;
+	if ((env = getenv("MEMTRACE_DEPTH")) != NULL) depth = atoi(env);
+	if (depth < 1) depth = 1;
+	if (depth > SITE_MAX_DEPTH) depth = SITE_MAX_DEPTH;
+	if ((env = getenv("MEMTRACE_SITES")) != NULL) n_sites = atoi(env);
+	if ((env = getenv("MEMTRACE_SIZES")) != NULL) n_sizes = atoi(env);
+	if ((env = getenv("MEMTRACE_POOL_ALLOCS")) != NULL) pool_allocs = strtoul(env, NULL, 0);
+	if ((env = getenv("MEMTRACE_POOL_US")) != NULL) pool_us = strtoul(env, NULL, 0);
+
+	// backtrace() loads the unwinder on first use; do it now rather than
+	// inside the first traced call
+	if (depth > 1) {
+		void* pc[2];
+		backtrace(pc, 2);
+	}
+
+	ready = true;
+	busy = 0;
+}
+
+//
+// report the call sites that allocated the most bytes
+//
+static int by_bytes(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	return (x->n_allocb < y->n_allocb) - (x->n_allocb > y->n_allocb);
+}
+
+static int by_copied(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	if (x->n_copied != y->n_copied) return x->n_copied < y->n_copied ? 1 : -1;
+	return (x->n_chains < y->n_chains) - (x->n_chains > y->n_chains);
+}
+
+static int by_calls(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	return (x->n_alloc < y->n_alloc) - (x->n_alloc > y->n_alloc);
+}
+
+static int by_frees(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	return (x->n_free < y->n_free) - (x->n_free > y->n_free);
+}
+
+static int by_ephemeral(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	return (x->n_ephemeral < y->n_ephemeral) - (x->n_ephemeral > y->n_ephemeral);
+}
+
+static int by_remote(const void* a, const void* b)
+{
+	const site* x = *(const site**)a;
+	const site* y = *(const site**)b;
+
+	return (x->n_remote < y->n_remote) - (x->n_remote > y->n_remote);
+}
+
+//
+// merge the site tables selected by table of all shards and sort them
+//
+//   table      returns the site table of a shard
+//   cmp        sort order
+//   all        merged table (to be freed by the caller)
+//
+// returns the number of sites in *sorted (to be freed by the caller)
+//
+static int merge_sorted(site* (*table)(shard*), int (*cmp)(const void*, const void*),
+                        site** all, site*** sorted)
+{
+	site* i;
+	shard* s;
+	int n = 0, k;
+
+	if ((*all = new_sites()) == NULL) return 0;
+
+	// the same call site (or size) may have been seen by several threads
+	for (s = shard_first(); s != NULL; s = s->next) {
+		for (i = table(s)->next; i != NULL; i = i->next) merge_site(*all, i);
+	}
+
+	for (i = (*all)->next; i != NULL; i = i->next) n++;
+	if ((n == 0) || ((*sorted = calloc(n, sizeof(site*))) == NULL)) return 0;
+
+	for (i = (*all)->next, k = 0; i != NULL; i = i->next) (*sorted)[k++] = i;
+	qsort(*sorted, n, sizeof(site*), cmp);
+
+	return n;
+}
+
+static site* sites_of(shard* s)
+{
+	return s->sites;
+}
+
+static site* sizes_of(shard* s)
+{
+	return s->sizes;
+}
+
+static site* threads_of(shard* s)
+{
+	return s->threads;
+}
+
+static void report_sites(void)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	char name[256];
+	int n, k, f;
+
+	if (n_sites <= 0) return;
+
+	n = merge_sorted(sites_of, by_bytes, &all, &sorted);
+
+	if (n > n_sites) n = n_sites;
+	if (n > 0) LOG_SITES_START(n);
+	for (k = 0; k < n; k++) {
+		i = sorted[k];
+		LOG_SITE(i->n_alloc, i->n_allocb, i->n_allocb - i->n_freeb,
+		         site_name(i->pc[0], name, sizeof(name)));
+		for (f = 1; f < i->depth; f++) {
+			LOG_SITE_FRAME(site_name(i->pc[f], name, sizeof(name)));
+		}
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// report the number of blocks and bytes allocated per size
+//
+static void report_sizes(stats* st)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	int n, k;
+
+	LOG_SIZES_START();
+	for (k = 0; k < HIST_BUCKETS; k++) {
+		if (st->sz_alloc[k] == 0) continue;
+		LOG_SIZE((unsigned long)hist_lower(k), (unsigned long)hist_upper(k),
+		         st->sz_alloc[k], st->sz_allocb[k],
+		         st->sz_allocb[k] - st->sz_freeb[k]);
+	}
+
+	if (n_sizes <= 0) return;
+
+	n = merge_sorted(sizes_of, by_calls, &all, &sorted);
+
+	if (n > n_sizes) n = n_sizes;
+	if (n > 0) LOG_TOP_SIZES_START(n);
+	for (k = 0; k < n; k++) {
+		i = sorted[k];
+		LOG_TOP_SIZE((unsigned long)(uintptr_t)i->pc[0], i->n_alloc,
+		             i->n_allocb, i->n_allocb - i->n_freeb);
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// account the realloc chain that ends with a block
+//
+static inline void chain_end(item* node)
+{
+	if (node->chain == 0) return;
+
+	site_chain(node->site, node->chain, node->copied, node->first, node->size,
+	           node->origin);
+}
+
+//
+// report the realloc chains that copied the most bytes. A chain would not
+// have copied anything had its first block been allocated with the largest
+// final size of the site's chains (the suggested reserve).
+//
+static void report_chains(void)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	char name[256];
+	int n, k, m;
+
+	if (n_sites <= 0) return;
+
+	n = merge_sorted(sites_of, by_copied, &all, &sorted);
+
+	for (m = 0; (m < n) && (m < n_sites) && (sorted[m]->n_chains > 0); m++);
+	if (m > 0) LOG_CHAINS_START(m);
+	for (k = 0; k < m; k++) {
+		i = sorted[k];
+		LOG_CHAIN(i->n_chains, i->n_grows, i->n_copied, i->max_first,
+		          i->max_final, site_name(i->pc[0], name, sizeof(name)));
+		if (i->origin != NULL) {
+			LOG_CHAIN_ORIGIN(site_name(i->origin->pc[0], name, sizeof(name)));
+		}
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// report the pairs of threads with the most blocks freed by another thread
+// than the one that allocated them, and their call sites
+//
+// the thread table has an entry per (allocating, freeing) thread pair. A
+// pair that frees most of the blocks of the allocating thread is a
+// producer/consumer pipeline that would benefit from a thread-affine pool.
+//
+#define PIPELINE_SHARE  50.0
+
+static void report_threads(void)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	char name[256];
+	unsigned long freed = 0, blocks = 0, bytes = 0, own;
+	double share;
+	int n, k, m, f;
+
+	if (n_sites <= 0) return;
+
+	n = merge_sorted(threads_of, by_frees, &all, &sorted);
+
+	for (k = 0; k < n; k++) {
+		freed += sorted[k]->n_free;
+		if (sorted[k]->pc[0] == sorted[k]->pc[1]) continue;
+		blocks += sorted[k]->n_free;
+		bytes += sorted[k]->n_freeb;
+	}
+
+	if (blocks > 0) {
+		for (k = 0, m = 0; k < n; k++) m += sorted[k]->pc[0] != sorted[k]->pc[1];
+		if (m > n_sites) m = n_sites;
+		LOG_THREADS_START(m, blocks, bytes, 100.0 * blocks / freed);
+
+		for (k = 0, m = 0; (k < n) && (m < n_sites); k++) {
+			i = sorted[k];
+			if (i->pc[0] == i->pc[1]) continue;
+
+			// share of the blocks of the allocating thread freed by this one
+			for (f = 0, own = 0; f < n; f++) {
+				if (sorted[f]->pc[0] == i->pc[0]) own += sorted[f]->n_free;
+			}
+			share = 100.0 * i->n_free / own;
+			LOG_THREAD_PAIR((int)(intptr_t)i->pc[0], (int)(intptr_t)i->pc[1],
+			                i->n_free, i->n_freeb, share,
+			                share > PIPELINE_SHARE ? "producer/consumer" : "");
+			m++;
+		}
+	}
+
+	free(sorted);
+	free_sites(all);
+
+	if (blocks == 0) return;
+
+	sorted = NULL;
+	n = merge_sorted(sites_of, by_remote, &all, &sorted);
+
+	for (m = 0; (m < n) && (m < n_sites) && (sorted[m]->n_remote > 0); m++);
+	if (m > 0) LOG_REMOTE_SITES_START(m);
+	for (k = 0; k < m; k++) {
+		i = sorted[k];
+		LOG_REMOTE_SITE(i->n_remote, i->n_remoteb,
+		                100.0 * i->n_remote / i->n_free,
+		                site_name(i->pc[0], name, sizeof(name)));
+		for (f = 1; f < i->depth; f++) {
+			LOG_SITE_FRAME(site_name(i->pc[f], name, sizeof(name)));
+		}
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// report the call sites that are candidates for an object pool, ranked by
+// the allocator calls a pool would save
+//
+static bool pool_candidate(const site* i)
+{
+	if ((i->n_ephemeral < POOL_MIN) || (i->n_free == 0)) return false;
+	if (100.0 * i->n_ephemeral / i->n_free < POOL_SHARE) return false;
+
+	return (i->max_size - i->min_size) * 100 <= i->min_size * POOL_SLACK;
+}
+
+static void report_pools(void)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	char name[256];
+	int n, k, m, f;
+
+	if (n_sites <= 0) return;
+
+	n = merge_sorted(sites_of, by_ephemeral, &all, &sorted);
+
+	for (k = 0, m = 0; k < n; k++) m += pool_candidate(sorted[k]);
+	if (m > n_sites) m = n_sites;
+	if (m > 0) LOG_POOLS_START(m, pool_allocs, pool_us);
+	for (k = 0; (k < n) && (m > 0); k++) {
+		i = sorted[k];
+		if (!pool_candidate(i)) continue;
+
+		LOG_POOL(2 * i->n_ephemeral, i->n_ephemeral,
+		         100.0 * i->n_ephemeral / i->n_free, i->min_size, i->max_size,
+		         site_name(i->pc[0], name, sizeof(name)));
+		for (f = 1; f < i->depth; f++) {
+			LOG_POOL_FRAME(site_name(i->pc[f], name, sizeof(name)));
+		}
+		m--;
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// report the lifetimes of freed blocks and the short-lived small blocks
+//
+static void report_lifetimes(stats* st)
+{
+	unsigned long total = 0;
+	int k;
+
+	for (k = 0; k < HIST_BUCKETS; k++) total += st->lt_allocs[k];
+	if (total == 0) return;
+
+	LOG_LIFETIMES_START("allocations");
+	for (k = 0; k < HIST_BUCKETS; k++) {
+		if (st->lt_allocs[k] == 0) continue;
+		LOG_LIFETIME((unsigned long)hist_lower(k), (unsigned long)hist_upper(k),
+		             st->lt_allocs[k], 100.0 * st->lt_allocs[k] / total);
+	}
+
+	LOG_LIFETIMES_START("ns");
+	for (k = 0; k < HIST_BUCKETS; k++) {
+		if (st->lt_ticks[k] == 0) continue;
+		LOG_LIFETIME((unsigned long)clock_ns(hist_lower(k)),
+		             (unsigned long)clock_ns(hist_upper(k)),
+		             st->lt_ticks[k], 100.0 * st->lt_ticks[k] / total);
+	}
+
+	LOG_SHORT_START((unsigned long)SHORT_SIZE, (unsigned long)SHORT_ALLOCS);
+	for (k = 0; k < HIST_BUCKETS; k++) {
+		if (st->sz_short[k] == 0) continue;
+		LOG_SHORT((unsigned long)hist_lower(k), (unsigned long)hist_upper(k),
+		          st->sz_short[k], 100.0 * st->sz_short[k] / st->sz_alloc[k]);
+	}
+}
+
+//
+// report the page occupancy of the live blocks and the call sites of the
+// blocks that pin mostly empty pages (see memfrag.h). Not meaningful in
+// sampling mode, where only the sampled blocks are known.
+//
+static void report_pages(frag* f)
+{
+	site** sorted;
+	site* i;
+	char name[256];
+	int n = 0, k, d;
+
+	if ((f == NULL) || (f->n == 0)) return;
+
+	LOG_PAGES(FRAG_PAGE, f->n, f->live_bytes, f->n_pinned, f->pinned_free,
+	          FRAG_PINNED);
+	for (k = 0; k < FRAG_BUCKETS; k++) {
+		if (f->hist[k] == 0) continue;
+		LOG_PAGE_OCCUPANCY(k * 100 / FRAG_BUCKETS, (k + 1) * 100 / FRAG_BUCKETS,
+		                   f->hist[k], 100.0 * f->hist[k] / f->n);
+	}
+
+	if ((n_sites <= 0) || (f->n_pinned == 0)) return;
+
+	for (i = f->pins->next; i != NULL; i = i->next) n++;
+	if ((sorted = malloc(n * sizeof(site*))) == NULL) return;
+	for (i = f->pins->next, k = 0; i != NULL; i = i->next) sorted[k++] = i;
+	qsort(sorted, n, sizeof(site*), by_calls);
+
+	if (n > n_sites) n = n_sites;
+	LOG_PINS_START(n);
+	for (k = 0; k < n; k++) {
+		i = sorted[k];
+		LOG_PIN(i->n_alloc, i->n_allocb,
+		        i->depth > 0 ? site_name(i->pc[0], name, sizeof(name))
+		                     : "(no call site)");
+		for (d = 1; d < i->depth; d++) {
+			LOG_PIN_FRAME(site_name(i->pc[d], name, sizeof(name)));
+		}
+	}
+
+	free(sorted);
+}
+
+//
+// report the memory obtained from the OS by the program and by the
+// allocator, and how much of the allocator's heap the live blocks account
+// for. The rest is per-block overhead (headers, rounding, blocks allocated
+// before the tracer was ready or by the tracer itself) and free chunks.
+//
+static void report_os(void)
+{
+	long pages, rss = -1;
+	size_t heap, used;
+	unsigned long live, blocks;
+	FILE* f;
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+
+	if ((f = fopen("/proc/self/statm", "re")) != NULL) {
+		if (fscanf(f, "%*s %ld", &pages) == 1) rss = pages * (long)page_size;
+		fclose(f);
+	}
+
+	// arena: bytes obtained with sbrk or for heaps of other arenas;
+	// hblkhd: chunks mapped individually
+	heap = (size_t)mi.arena + (size_t)mi.hblkhd;
+	used = (size_t)mi.uordblks + (size_t)mi.hblkhd;
+	live_sum(&live, &blocks);
+
+	LOG_OS_MEMORY(n_os[EV_MMAP - EV_MMAP], n_os[EV_MUNMAP - EV_MMAP],
+	              n_os[EV_MREMAP - EV_MMAP],
+	              n_os[EV_BRK - EV_MMAP] + n_os[EV_SBRK - EV_MMAP],
+	              (long)map_bytes, (long)map_peak, brk_bytes);
+	LOG_HEAP(heap, live, used > live ? used - live : 0, (size_t)mi.fordblks, rss);
+}
+
+//
+// report the call sites that mapped the most memory
+//
+static site* maps_of(shard* s)
+{
+	return s->maps;
+}
+
+static void report_map_sites(void)
+{
+	site* all;
+	site** sorted = NULL;
+	site* i;
+	char name[256];
+	int n, k, f;
+
+	if (n_sites <= 0) return;
+
+	n = merge_sorted(maps_of, by_bytes, &all, &sorted);
+
+	if (n > n_sites) n = n_sites;
+	if (n > 0) LOG_MAP_SITES_START(n);
+	for (k = 0; k < n; k++) {
+		i = sorted[k];
+		LOG_MAP_SITE(i->n_alloc, i->n_allocb, site_name(i->pc[0], name, sizeof(name)));
+		for (f = 1; f < i->depth; f++) {
+			LOG_MAP_SITE_FRAME(site_name(i->pc[f], name, sizeof(name)));
+		}
+	}
+
+	free(sorted);
+	free_sites(all);
+}
+
+//
+// report latency percentiles per call type and size class and the slowest
+// calls of all threads
+//
+static int by_ticks(const void* a, const void* b)
+{
+	const slow_call* x = a;
+	const slow_call* y = b;
+
+	if (x->ticks != y->ticks) return x->ticks < y->ticks ? 1 : -1;
+	return 0;
+}
+
+static void report_latency(void)
+{
+	latency* total;
+	shard* s;
+	unsigned long* h;
+	unsigned long n;
+	char name[256];
+	int o, c, k;
+
+	if (!timing) return;
+
+	total = meta_map(sizeof(latency));
+	if (total == NULL) return;
+
+	for (s = shard_first(); s != NULL; s = s->next) {
+		if (s->lat != NULL) lat_merge(total, s->lat);
+	}
+
+	LOG_LATENCY_START();
+	for (o = 0; o < LAT_OPS; o++) {
+		for (c = 0; c < LAT_CLASSES; c++) {
+			h = total->hist[o][c];
+			for (n = 0, k = 0; k < LAT_BUCKETS; k++) n += h[k];
+			if (n == 0) continue;
+
+			LOG_LATENCY(op_name[o], (unsigned long)lat_class_lower(c),
+			            c < LAT_CLASSES - 1 ? (unsigned long)lat_class_lower(c + 1) - 1 : ULONG_MAX,
+			            n,
+			            (unsigned long)clock_ns(lat_percentile(h, 0.5)),
+			            (unsigned long)clock_ns(lat_percentile(h, 0.99)),
+			            (unsigned long)clock_ns(lat_percentile(h, 0.999)));
+		}
+	}
+
+	qsort(total->slow, total->n_slow, sizeof(slow_call), by_ticks);
+	if (total->n_slow > 0) LOG_SLOWEST_START(total->n_slow);
+	for (k = 0; k < total->n_slow; k++) {
+		LOG_SLOW((unsigned long)clock_ns(total->slow[k].ticks),
+		         op_name[total->slow[k].op], total->slow[k].size,
+		         total->slow[k].site ? site_name(total->slow[k].site->pc[0], name, sizeof(name))
+		                             : "?");
+	}
+
+	meta_unmap(total, sizeof(latency));
+}
+
+//
+// fini - this function is called once when the shared library is unloaded
+//
+__attribute__((destructor))
+void fini(void)
+{
+	char path[PATH_MAX];
+	stats st;
+	long n_alloc_total;
+	long avg_allocb;
+	shard* s;
+	item* node;
+	frag* pages;
+	unsigned long live_bytes, live_blocks;
+	bool found = false;
+
+	busy = 1;
+
+	stop_agent();
+
+	shard_stats(&st);
+
+	if (!HAVE_TABLE) {
+		LOG_CALLS(st.n_malloc, st.n_calloc, st.n_realloc, st.n_memalign,
+		          st.n_new, st.n_free, st.n_allocb);
+		LOG_STOP();
+		ready = false;
+		return;
+	}
+
+	if (sample > 0) LOG_SAMPLING(sample);
+
+	n_alloc_total = st.n_malloc + st.n_calloc + st.n_realloc + st.n_memalign +
+	                st.n_new;
+	avg_allocb = n_alloc_total ? st.n_allocb / n_alloc_total : 0;
+
+	update_peak();
+	live_sum(&live_bytes, &live_blocks);
+
+	LOG_STATISTICS(st.n_allocb, avg_allocb, st.n_freeb);
+	LOG_PEAK(peak_bytes, peak_blocks,
+	         peak_tsc ? clock_ns(peak_tsc - start_tsc) / 1e6 : 0.0,
+	         live_bytes, live_blocks);
+	if ((st.n_double_free > 0) || (st.n_illegal_free > 0)) {
+		LOG_INVALID_FREES(st.n_double_free, st.n_illegal_free);
+	}
+
+	for (s = shard_first(); s != NULL; s = s->next) {
+		node = s->list;
+		while ((node = node->next) != NULL) {
+			if (node->cnt > 0) {
+				chain_end(node);
+				if (!found) {
+					LOG_NONFREED_START();
+					found = true;
+				}
+				LOG_BLOCK(node->ptr, node->size, node->cnt);
+			}
+		}
+	}
+
+	report_sizes(&st);
+	report_lifetimes(&st);
+	report_sites();
+	report_chains();
+	report_threads();
+	report_pools();
+	report_latency();
+
+	pages = sample > 0 ? NULL : frag_scan();
+	report_pages(pages);
+
+	report_os();
+	report_map_sites();
+
+	if (prof_prefix != NULL) {
+		snprintf(path, sizeof(path), "%s.%d.heap", prof_prefix, (int)getpid());
+		profile(path);
+	}
+
+	if ((heat_prefix != NULL) && (sample == 0)) {
+		snprintf(path, sizeof(path), "%s.%d.heat", heat_prefix, (int)getpid());
+		heatmap(path, pages);
+	}
+	frag_free(pages);
+
+	LOG_OVERHEAD(meta_bytes(),
+	             peak_bytes ? 100.0 * meta_bytes() / peak_bytes : 0.0);
+
+	LOG_STOP();
+
+	// the shards are not freed: other threads may still be running and
+	// allocating while the process exits. Stop tracing instead.
+	ready = false;
+}
+
+//
+// enter the tracer; returns the shard of the calling thread or NULL if the
+// call must not be traced
+//
+static inline shard* enter(void)
+{
+	shard* s;
+
+	if (!ready || busy) return NULL;
+
+	busy = 1;
+	s = shard_self();
+	if (s == NULL) busy = 0;
+
+	return s;
+}
+
+static inline void leave(void)
+{
+	busy = 0;
+}
+
+//
+// log a call, either as text or as a binary event
+//
+//   op         event type (EV_*)
+//   flags      EVF_DOUBLE_FREE/EVF_ILLEGAL_FREE for rejected deallocations
+//   p          pointer argument (realloc, free, delete) or alignment
+//              (memalign, new)
+//   nmemb,
+//   size       size arguments (nmemb is 1 except for calloc)
+//   res        returned pointer
+//   tsc        time stamp of the call
+//
+// the arguments of the OS-level calls are encoded as in the binary events
+// (see memevent.h)
+//
+static void log_event(shard* s, int op, int flags, void* p, size_t nmemb,
+                      size_t size, void* res, uint64_t tsc)
+{
+	if (!HAVE_LOG || (mode == MODE_OFF)) return;
+
+	if (mode == MODE_BINARY) {
+		// calloc keeps nmemb in ptr and the total size in size
+		if (op == EV_CALLOC) p = (void*)nmemb;
+		event_put(s, op, flags, p, nmemb*size, res, tsc);
+		return;
+	}
+
+	switch (op) {
+		case EV_MALLOC:  LOG_MALLOC(size, res); break;
+		case EV_CALLOC:  LOG_CALLOC(nmemb, size, res); break;
+		case EV_REALLOC: LOG_REALLOC(p, size, res); break;
+		case EV_FREE:    LOG_FREE(p); break;
+		case EV_MEMALIGN: LOG_MEMALIGN((size_t)p, size, res); break;
+		case EV_NEW:     LOG_NEW((size_t)p, size, res); break;
+		case EV_DELETE:  LOG_DELETE(p); break;
+		case EV_MMAP:    LOG_MMAP(size, (int)((uintptr_t)p & 0xff), (int)((uintptr_t)p >> 8), res); break;
+		case EV_MUNMAP:  LOG_MUNMAP(p, size); break;
+		case EV_MREMAP:  LOG_MREMAP(p, size, res); break;
+		case EV_BRK:     LOG_BRK(p, (int)(intptr_t)res); break;
+		case EV_SBRK:    LOG_SBRK((long)size, res); break;
+	}
+
+	if (flags & EVF_DOUBLE_FREE) LOG_DOUBLE_FREE();
+	if (flags & EVF_ILLEGAL_FREE) LOG_ILL_FREE();
+}
+
+//
+// get the call site of an allocation
+//
+//   table      site table to add the site to
+//   caller     return address of the interposed function
+//
+// with MEMTRACE_DEPTH > 1 the frames above the caller are unwound as well.
+// The backtrace starts inside the tracer; frames up to the caller are
+// skipped.
+//
+#define TRACER_FRAMES   4
+
+static site* locate(site* table, void* caller)
+{
+	void* pc[SITE_MAX_DEPTH + TRACER_FRAMES];
+	int n, k;
+
+	if (depth > 1) {
+		n = backtrace(pc, depth + TRACER_FRAMES);
+		for (k = 0; (k < n) && (pc[k] != caller); k++);
+		if (k < n) {
+			if (n - k > depth) n = k + depth;
+			return get_site(table, pc + k, n - k);
+		}
+	}
+
+	pc[0] = caller;
+	return get_site(table, pc, 1);
+}
+
+//
+// draw the next sampling interval, -sample * ln(U) with U uniform in (0, 1]
+//
+static long draw_interval(shard* s)
+{
+	uint64_t x = s->rng;
+	double u, n;
+
+	if (x == 0) x = clock_ticks() ^ ((uint64_t)s->tid << 32) ^ 0x9e3779b97f4a7c15ULL;
+
+	// xorshift64*
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	s->rng = x;
+
+	u = (double)(((x * 0x2545f4914f6cdd1dULL) >> 11) + 1) / 9007199254740992.0;
+	n = -log(u) * (double)sample;
+
+	return n < 1.0 ? 1 : (n > (double)LONG_MAX ? LONG_MAX : (long)n);
+}
+
+//
+// called when the countdown of the calling thread reached zero; returns true
+// if the allocation is sampled
+//
+static bool sample_hit(shard* s)
+{
+	// the first interval of a thread starts at its first allocation
+	if (!sample_armed) {
+		sample_armed = true;
+		sample_left += draw_interval(s);
+		if (sample_left > 0) return false;
+	}
+
+	sample_left = draw_interval(s);
+
+	return true;
+}
+
+//
+// number of blocks and bytes represented by a traced block of the given size
+//
+static void weigh(size_t size, unsigned long* n, unsigned long* bytes)
+{
+	double p;
+
+	if ((sample == 0) || (size == 0)) {
+		*n = 1;
+		*bytes = size;
+		return;
+	}
+
+	p = -expm1(-(double)size / (double)sample);
+	*n = (unsigned long)(1.0 / p + 0.5);
+	*bytes = (unsigned long)((double)size / p + 0.5);
+}
+
+static inline unsigned int* filter_slot(void* ptr)
+{
+	return &filter[(((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL) >> (64 - FILTER_BITS)];
+}
+
+//
+// returns false if ptr is certainly not a sampled block
+//
+static inline bool maybe_sampled(void* ptr)
+{
+	return (ptr != NULL) && (__atomic_load_n(filter_slot(ptr), __ATOMIC_RELAXED) != 0);
+}
+
+//
+// get the entry of an exact request size in the size table of a shard
+//
+static inline site* size_entry(shard* s, size_t size)
+{
+	void* key = (void*)(uintptr_t)size;
+
+	return get_site(s->sizes, &key, 1);
+}
+
+//
+// get the entry of the thread that allocated a block in the thread table of
+// the freeing shard
+//
+static inline site* thread_entry(shard* s, int tid)
+{
+	void* key[2] = { (void*)(intptr_t)tid, (void*)(intptr_t)s->tid };
+
+	return get_site(s->threads, key, 2);
+}
+
+//
+// record a newly allocated block; returns the number of calls it represents
+//
+//   tsc        time stamp of the call
+//   prev       the block this one replaces (realloc) or NULL
+//
+// a block created by realloc continues the realloc chain of prev.
+//
+static unsigned long trace_alloc(shard* s, void* ptr, size_t size, void* caller,
+                                 uint64_t tsc, item* prev)
+{
+	unsigned long n, bytes;
+	item* node;
+	unsigned int chain = 0;
+	size_t first = size, copied = 0;
+	site* origin = NULL;
+	int k;
+
+	weigh(size, &n, &bytes);
+	if (ptr == NULL) return n;
+
+	k = hist_bucket(size);
+	s->st.n_allocb += bytes;
+	s->st.sz_alloc[k] += n;
+	s->st.sz_allocb[k] += bytes;
+	site_alloc(size_entry(s, size), n, bytes);
+	live_add(s, s, n, bytes, tsc);
+
+	// prev may be the item shard_alloc() reuses; read it first
+	if (prev != NULL) {
+		chain = prev->chain + 1;
+		first = prev->chain ? prev->first : prev->size;
+		origin = prev->chain ? prev->origin : prev->site;
+		copied = prev->copied;
+		if (ptr != prev->ptr) copied += prev->size < size ? prev->size : size;
+	}
+
+	node = shard_alloc(s, ptr, size);
+	if (node == NULL) return n;
+
+	node->site = locate(s->sites, caller);
+	node->tsc = tsc;
+	node->seq = ((unsigned long)s->id << SEQ_SHIFT) | (s->seq & SEQ_MASK);
+	__atomic_store_n(&s->seq, s->seq + n, __ATOMIC_RELAXED);
+	node->chain = chain;
+	node->first = first;
+	node->copied = copied;
+	node->origin = origin;
+	node->tid = s->tid;
+	site_size(node->site, size);
+	site_alloc(node->site, n, bytes);
+
+	if (sample > 0) __atomic_fetch_add(filter_slot(ptr), 1, __ATOMIC_RELAXED);
+
+	return n;
+}
+
+//
+// record a deallocation; returns 0 if ptr is a live block that may be
+// passed to libc, EVF_DOUBLE_FREE or EVF_ILLEGAL_FREE otherwise. The item
+// of the released block is stored in freed.
+//
+// In sampling mode a block that is not found was simply not sampled; the
+// caller passes it to libc.
+//
+static int trace_free(shard* s, void* ptr, item** freed)
+{
+	unsigned long n, bytes;
+	item* node;
+	item* dead;
+	int k;
+
+	*freed = NULL;
+
+	node = shard_dealloc(s, ptr, &dead);
+	if (node == NULL) {
+		return dead != NULL ? EVF_DOUBLE_FREE : EVF_ILLEGAL_FREE;
+	}
+
+	weigh(node->size, &n, &bytes);
+	k = hist_bucket(node->size);
+	s->st.n_free += n;
+	s->st.n_freeb += bytes;
+	s->st.sz_free[k] += n;
+	s->st.sz_freeb[k] += bytes;
+	site_free(node->site, n, bytes);
+	site_free(size_entry(s, node->size), n, bytes);
+	site_free(thread_entry(s, node->tid), n, bytes);
+	if (node->tid != s->tid) site_remote(node->site, n, bytes);
+	live_add(s, owner_of(s, node), -(long)n, -(long)bytes, 0);
+	*freed = node;
+
+	if (sample > 0) __atomic_fetch_sub(filter_slot(ptr), 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+//
+// count a deallocation rejected by trace_free(); the count is reported at
+// exit in every log mode
+//
+static void count_invalid(shard* s, int flags)
+{
+	if (flags & EVF_DOUBLE_FREE) s->st.n_double_free++;
+	if (flags & EVF_ILLEGAL_FREE) s->st.n_illegal_free++;
+}
+
+//
+// is a block that lived for the given number of allocations and ticks
+// short-lived enough for a pool?
+//
+static bool ephemeral(unsigned long allocs, uint64_t ticks)
+{
+	uint64_t t;
+
+	if (allocs < pool_allocs) return true;
+	if (pool_us == 0) return false;
+
+	t = __atomic_load_n(&pool_ticks, __ATOMIC_RELAXED);
+	if (t == 0) {
+		if (clock_mono_ns() - start_ns < POOL_CALIBRATE_NS) return false;
+		t = (uint64_t)((double)pool_us * 1e3 * 1e9 / (double)clock_ns(1000000000ULL));
+		if (t == 0) t = 1;
+		__atomic_store_n(&pool_ticks, t, __ATOMIC_RELAXED);
+	}
+
+	return ticks < t;
+}
+
+//
+// record the lifetime of a block that was freed by trace_free()
+//
+//   tsc        time stamp of the deallocation
+//
+static void trace_lifetime(shard* s, item* node, uint64_t tsc)
+{
+	unsigned long n, bytes, allocs, now;
+	shard* o = s;
+	int id = (int)(node->seq >> SEQ_SHIFT);
+
+	// blocks of other threads are timed by the clock of their shard
+	if (id != s->id) {
+		for (o = shard_first(); (o != NULL) && (o->id != id); o = o->next);
+	}
+
+	weigh(node->size, &n, &bytes);
+	now = o != NULL ? __atomic_load_n(&o->seq, __ATOMIC_RELAXED) : node->seq + n;
+	allocs = (now - node->seq - n) & SEQ_MASK;
+
+	s->st.lt_allocs[hist_bucket(allocs)] += n;
+	s->st.lt_ticks[hist_bucket(tsc - node->tsc)] += n;
+
+	if ((node->size <= SHORT_SIZE) && (allocs < SHORT_ALLOCS)) {
+		s->st.sz_short[hist_bucket(node->size)] += n;
+	}
+	if (ephemeral(allocs, tsc - node->tsc)) site_ephemeral(node->site, n);
+}
+
+//
+// undo trace_free() for a block that is still allocated (failed realloc)
+//
+static void untrace_free(shard* s, item* old)
+{
+	unsigned long n, bytes, age = 0;
+	item* node;
+	shard* o;
+	int k;
+
+	weigh(old->size, &n, &bytes);
+	k = hist_bucket(old->size);
+	s->st.n_free -= n;
+	s->st.n_freeb -= bytes;
+	s->st.sz_free[k] -= n;
+	s->st.sz_freeb[k] -= bytes;
+	site_free(size_entry(s, old->size), -n, -bytes);
+	site_free(thread_entry(s, old->tid), -n, -bytes);
+	live_add(s, s, n, bytes, clock_ticks());
+
+	node = shard_alloc(s, old->ptr, old->size);
+	if (node == NULL) return;
+
+	// the block moves to this shard; keep its age in allocations
+	if ((o = owner_of(s, old)) != NULL) {
+		age = (__atomic_load_n(&o->seq, __ATOMIC_RELAXED) - old->seq) & SEQ_MASK;
+	}
+
+	node->tsc = old->tsc;
+	node->seq = ((unsigned long)s->id << SEQ_SHIFT) | ((s->seq - age) & SEQ_MASK);
+	node->chain = old->chain;
+	node->first = old->first;
+	node->copied = old->copied;
+	node->origin = old->origin;
+	node->tid = old->tid;
+
+	// take back the freed counts of the site (unsigned wrap-around)
+	node->site = old->site;
+	site_free(node->site, -n, -bytes);
+	if (old->tid != s->tid) site_remote(node->site, -n, -bytes);
+
+	if (sample > 0) __atomic_fetch_add(filter_slot(old->ptr), 1, __ATOMIC_RELAXED);
+}
+
+//
+// account the latency of a call into libc
+//
+//   op         event type (EV_*)
+//   size       requested size (size of the block for free/delete)
+//   ticks      latency
+//   caller     return address of the interposed function (allocations) or
+//   where      call site of the freed block
+//
+// the call site of an allocation is only looked up if the call is among
+// the slowest so far
+//
+static void time_call(shard* s, int op, size_t size, uint64_t ticks,
+                      void* caller, site* where)
+{
+	if (s->lat == NULL) {
+		s->lat = meta_map(sizeof(latency));
+		if (s->lat == NULL) return;
+	}
+
+	if (!lat_record(s->lat, op, size, ticks)) return;
+
+	if (caller != NULL) where = locate(s->sites, caller);
+	lat_slow(s->lat, op, size, ticks, where);
+}
+
+//
+// count a call without tracing it (VARIANT_COUNTERS)
+//
+//   op         event type (EV_*)
+//   bytes      allocated bytes (0 for free and delete)
+//
+static inline __attribute__((always_inline))
+void count_call(int op, size_t bytes)
+{
+	shard* s;
+
+	if ((s = enter()) == NULL) return;
+
+	switch (op) {
+		case EV_MALLOC:   s->st.n_malloc++; break;
+		case EV_CALLOC:   s->st.n_calloc++; break;
+		case EV_REALLOC:  s->st.n_realloc++; break;
+		case EV_MEMALIGN: s->st.n_memalign++; break;
+		case EV_NEW:      s->st.n_new++; break;
+		default:          s->st.n_free++; break;
+	}
+	s->st.n_allocb += bytes;
+
+	leave();
+}
+
+//
+// trace a call that allocated a block
+//
+//   op         EV_MALLOC, EV_CALLOC, EV_MEMALIGN or EV_NEW
+//   align      requested alignment (EV_MEMALIGN, aligned EV_NEW) or 0
+//   nmemb,
+//   size       size arguments (nmemb is 1 except for calloc)
+//   ptr        returned block (NULL if the call failed)
+//   caller     return address of the interposed function
+//
+// in sampling mode the fast path only counts down the allocated bytes.
+//
+static inline __attribute__((always_inline))
+void alloc_call(int op, size_t align, size_t nmemb, size_t size, void* ptr,
+                void* caller, uint64_t start)
+{
+	unsigned long n;
+	shard* s;
+	uint64_t tsc, end = start ? clock_ticks() : 0;
+
+	if (!HAVE_TABLE) {
+		count_call(op, ptr != NULL ? nmemb*size : 0);
+		return;
+	}
+
+	if ((sample > 0) && ((sample_left -= nmemb*size) > 0)) return;
+
+	if ((s = enter()) == NULL) return;
+
+	if ((sample > 0) && !sample_hit(s)) {
+		leave();
+		return;
+	}
+
+	tsc = clock_ticks();
+	log_event(s, op, 0, (void*)align, nmemb, size, ptr, tsc);
+
+	n = trace_alloc(s, ptr, nmemb*size, caller, tsc, NULL);
+	switch (op) {
+		case EV_MALLOC:   s->st.n_malloc += n; break;
+		case EV_CALLOC:   s->st.n_calloc += n; break;
+		case EV_MEMALIGN: s->st.n_memalign += n; break;
+		case EV_NEW:      s->st.n_new += n; break;
+	}
+
+	if (start) time_call(s, op, nmemb*size, end - start, caller, NULL);
+
+	leave();
+}
+
+//
+// trace a call that frees a block and pass the block to libc unless the
+// call is rejected
+//
+//   op         EV_FREE or EV_DELETE
+//
+static inline __attribute__((always_inline))
+void free_call(int op, void* ptr)
+{
+	shard* s;
+	item* node;
+	int flags = 0;
+	uint64_t tsc, start;
+	size_t size = 0;
+	site* where = NULL;
+
+	if (boot_owns(ptr)) return;
+
+	if (!HAVE_TABLE) {
+		count_call(op, 0);
+		freep(ptr);
+		return;
+	}
+
+	if (((sample > 0) && !maybe_sampled(ptr)) || ((s = enter()) == NULL)) {
+		freep(ptr);
+		return;
+	}
+
+	// validity check; trace_free() counts the released blocks
+	tsc = clock_ticks();
+	if (ptr != NULL) flags = trace_free(s, ptr, &node);
+	if ((ptr != NULL) && (flags == 0)) {
+		trace_lifetime(s, node, tsc);
+		chain_end(node);
+		// the item is reused as soon as libc hands out the block again
+		size = node->size;
+		where = node->site;
+	}
+	if (sample > 0) flags = 0;
+	if ((ptr == NULL) || (flags != 0)) s->st.n_free++;
+	count_invalid(s, flags);
+
+	// log before the block is released so that its reuse by another
+	// thread is time-stamped after this call
+	log_event(s, op, flags, ptr, 1, 0, NULL, tsc);
+
+	if ((ptr != NULL) && (flags == 0)) {
+		start = lat_start();
+		freep(ptr);
+		if (start) time_call(s, op, size, clock_ticks() - start, NULL, where);
+	}
+
+	leave();
+}
+
+//
+// trace a call to realloc
+//
+static void* realloc_call(void* p, size_t size, void* caller)
+{
+	void* ptr;
+	shard* s;
+	item* old = NULL;
+	item prev;
+	int flags;
+	bool hit = true;
+	uint64_t tsc;
+
+	// move bootstrap blocks to libc
+	if (boot_owns(p)) {
+		ptr = realloc_call(NULL, size, caller);
+		if (ptr != NULL) memcpy(ptr, p, boot_size(p) < size ? boot_size(p) : size);
+		return ptr;
+	}
+
+	if (!HAVE_TABLE) {
+		ptr = reallocp(p, size);
+		count_call(EV_REALLOC, ptr != NULL ? size : 0);
+		return ptr;
+	}
+
+	// in sampling mode, the new block is sampled like an allocation and
+	// the old block only needs to be looked up if it may have been sampled
+	if (sample > 0) {
+		hit = (sample_left -= size) <= 0;
+		if (!hit && !maybe_sampled(p)) return reallocp(p, size);
+	}
+
+	if ((s = enter()) == NULL) return reallocp(p, size);
+
+	if (hit && (sample > 0)) hit = sample_hit(s);
+
+	// release the old block before libc can hand its address to another
+	// thread. Blocks we do not know about (e.g., allocated before the tracer
+	// was loaded) are passed to libc unchanged.
+	if (p != NULL) {
+		flags = trace_free(s, p, &old);
+		if ((flags == EVF_DOUBLE_FREE) && (sample == 0)) {
+			count_invalid(s, flags);
+			log_event(s, EV_REALLOC, flags, p, 1, size, NULL, clock_ticks());
+			leave();
+			return NULL;
+		}
+	}
+
+	// once libc has the block, the owner of its item (possibly another
+	// thread) may reuse the item for a new block at the same address; keep
+	// what the chain needs
+	if (old != NULL) {
+		prev = *old;
+		old = &prev;
+	}
+
+	tsc = clock_ticks();
+	ptr = reallocp(p, size);
+	if (timing) time_call(s, EV_REALLOC, size, clock_ticks() - tsc, caller, NULL);
+	log_event(s, EV_REALLOC, 0, p, 1, size, ptr, tsc);
+
+	if ((ptr == NULL) && (size != 0) && (old != NULL)) {
+		// realloc failed, the old block is still allocated
+		s->st.n_realloc++;
+		untrace_free(s, old);
+	} else {
+		// the old block ends here; its chain continues in the new one
+		if (old != NULL) trace_lifetime(s, old, tsc);
+		if ((old != NULL) && (ptr == NULL)) chain_end(old);   // realloc(p, 0)
+		if (hit) s->st.n_realloc += trace_alloc(s, ptr, size, caller, tsc, old);
+	}
+
+	leave();
+
+	return ptr;
+}
+
+void* malloc(size_t size) {
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = mallocp(size);
+	alloc_call(EV_MALLOC, 0, 1, size, ptr, __builtin_return_address(0), start);
+
+	return ptr;
+}
+
+void free(void* ptr) {
+	free_call(EV_FREE, ptr);
+}
+
+void* calloc(size_t count, size_t size) {
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = callocp(count, size);
+	alloc_call(EV_CALLOC, 0, count, size, ptr, __builtin_return_address(0),
+	           start);
 
 	return ptr;
 }
+
+void* realloc(void* p, size_t size) {
+	return realloc_call(p, size, __builtin_return_address(0));
+}
+
+void* reallocarray(void* p, size_t nmemb, size_t size) {
+	size_t bytes;
+
+	if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return realloc_call(p, bytes, __builtin_return_address(0));
+}
+
+//
+// aligned allocations
+//
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+	uint64_t start = lat_start();
+	int res;
+
+	res = posix_memalignp(memptr, alignment, size);
+	alloc_call(EV_MEMALIGN, alignment, 1, size, res == 0 ? *memptr : NULL,
+	           __builtin_return_address(0), start);
+
+	return res;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = aligned_allocp(alignment, size);
+	alloc_call(EV_MEMALIGN, alignment, 1, size, ptr, __builtin_return_address(0),
+	           start);
+
+	return ptr;
+}
+
+void* memalign(size_t alignment, size_t size) {
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = memalignp(alignment, size);
+	alloc_call(EV_MEMALIGN, alignment, 1, size, ptr, __builtin_return_address(0),
+	           start);
+
+	return ptr;
+}
+
+void* valloc(size_t size) {
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = vallocp(size);
+	alloc_call(EV_MEMALIGN, (size_t)sysconf(_SC_PAGESIZE), 1, size, ptr,
+	           __builtin_return_address(0), start);
+
+	return ptr;
+}
+
+void* pvalloc(size_t size) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = lat_start();
+	void* ptr;
+
+	ptr = pvallocp(size);
+	alloc_call(EV_MEMALIGN, page, 1, (size + page - 1) & ~(page - 1), ptr,
+	           __builtin_return_address(0), start);
+
+	return ptr;
+}
+
+//
+// malloc_usable_size does not change the heap; it is forwarded so that the
+// whole allocator API goes through the tracer
+//
+size_t malloc_usable_size(void* ptr) {
+	if (boot_owns(ptr)) return boot_size(ptr);
+	return malloc_usable_sizep(ptr);
+}
+
+//
+// C++ operator new/delete (Itanium C++ ABI names)
+//
+// new allocates with libc directly and traces the block as EV_NEW. Only if
+// that fails the call is forwarded to the C++ runtime, which runs the new
+// handler and throws std::bad_alloc (or returns NULL for the nothrow
+// versions); its retries are traced as plain malloc calls. All versions of
+// delete release the block like free().
+//
+#define NEW_ALIGN(al)   ((al) < sizeof(void*) ? sizeof(void*) : (al))
+
+static inline __attribute__((always_inline))
+void* new_call(size_t size, size_t align, void* caller)
+{
+	void* ptr = NULL;
+	uint64_t start;
+
+	if (size == 0) size = 1;
+
+	start = lat_start();
+	if (align == 0) {
+		ptr = mallocp(size);
+	} else {
+		if (posix_memalignp(&ptr, NEW_ALIGN(align), size) != 0) ptr = NULL;
+	}
+
+	if (ptr != NULL) alloc_call(EV_NEW, align, 1, size, ptr, caller, start);
+
+	return ptr;
+}
+
+static inline __attribute__((always_inline))
+void delete_call(void* ptr)
+{
+	free_call(EV_DELETE, ptr);
+}
+
+//
+// forward a failed allocation to the C++ runtime
+//
+#define NEW_FALLBACK(name, proto, ...) \
+	{ \
+		static void* (*nextp)proto = NULL; \
+		if (!nextp) nextp = dlsym(RTLD_NEXT, name); \
+		return nextp ? nextp(__VA_ARGS__) : NULL; \
+	}
+
+typedef struct { int _; } nothrow_t;
+
+// operator new(size_t), operator new[](size_t)
+void* _Znwm(size_t size) {
+	void* ptr = new_call(size, 0, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_Znwm", (size_t), size);
+}
+
+void* _Znam(size_t size) {
+	void* ptr = new_call(size, 0, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_Znam", (size_t), size);
+}
+
+// operator new(size_t, const std::nothrow_t&), operator new[](...)
+void* _ZnwmRKSt9nothrow_t(size_t size, const nothrow_t* nt) {
+	void* ptr = new_call(size, 0, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnwmRKSt9nothrow_t", (size_t, const nothrow_t*), size, nt);
+}
+
+void* _ZnamRKSt9nothrow_t(size_t size, const nothrow_t* nt) {
+	void* ptr = new_call(size, 0, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnamRKSt9nothrow_t", (size_t, const nothrow_t*), size, nt);
+}
+
+// operator new(size_t, std::align_val_t), operator new[](...)
+void* _ZnwmSt11align_val_t(size_t size, size_t align) {
+	void* ptr = new_call(size, align, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnwmSt11align_val_t", (size_t, size_t), size, align);
+}
+
+void* _ZnamSt11align_val_t(size_t size, size_t align) {
+	void* ptr = new_call(size, align, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnamSt11align_val_t", (size_t, size_t), size, align);
+}
+
+// operator new(size_t, std::align_val_t, const std::nothrow_t&), new[](...)
+void* _ZnwmSt11align_val_tRKSt9nothrow_t(size_t size, size_t align,
+                                          const nothrow_t* nt) {
+	void* ptr = new_call(size, align, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnwmSt11align_val_tRKSt9nothrow_t",
+	             (size_t, size_t, const nothrow_t*), size, align, nt);
+}
+
+void* _ZnamSt11align_val_tRKSt9nothrow_t(size_t size, size_t align,
+                                          const nothrow_t* nt) {
+	void* ptr = new_call(size, align, __builtin_return_address(0));
+	if (ptr != NULL) return ptr;
+	NEW_FALLBACK("_ZnamSt11align_val_tRKSt9nothrow_t",
+	             (size_t, size_t, const nothrow_t*), size, align, nt);
+}
+
+// operator delete(void*), delete[], and the sized, aligned and nothrow
+// versions
+void _ZdlPv(void* ptr) { delete_call(ptr); }
+void _ZdaPv(void* ptr) { delete_call(ptr); }
+void _ZdlPvm(void* ptr, size_t size) { delete_call(ptr); }
+void _ZdaPvm(void* ptr, size_t size) { delete_call(ptr); }
+void _ZdlPvSt11align_val_t(void* ptr, size_t align) { delete_call(ptr); }
+void _ZdaPvSt11align_val_t(void* ptr, size_t align) { delete_call(ptr); }
+void _ZdlPvmSt11align_val_t(void* ptr, size_t size, size_t align) { delete_call(ptr); }
+void _ZdaPvmSt11align_val_t(void* ptr, size_t size, size_t align) { delete_call(ptr); }
+void _ZdlPvRKSt9nothrow_t(void* ptr, const nothrow_t* nt) { delete_call(ptr); }
+void _ZdaPvRKSt9nothrow_t(void* ptr, const nothrow_t* nt) { delete_call(ptr); }
+void _ZdlPvSt11align_val_tRKSt9nothrow_t(void* ptr, size_t align,
+                                         const nothrow_t* nt) { delete_call(ptr); }
+void _ZdaPvSt11align_val_tRKSt9nothrow_t(void* ptr, size_t align,
+                                         const nothrow_t* nt) { delete_call(ptr); }
+
+//
+// OS-level memory
+//
+// the calls are traced in every mode (they are rare); the mapped bytes are
+// counted in whole pages and attributed to the call site of the mapping
+// call
+//
+static inline size_t page_round(size_t len)
+{
+	return (len + page_size - 1) & ~(page_size - 1);
+}
+
+//
+// trace an OS-level call
+//
+//   op         EV_MMAP, EV_MUNMAP, EV_MREMAP, EV_BRK or EV_SBRK
+//   p, size,
+//   res        arguments and result as recorded in the event (memevent.h)
+//   bytes      bytes mapped (negative: unmapped) by the call
+//   caller     return address of the interposed function
+//
+static void map_add(long bytes)
+{
+	unsigned long m = __atomic_load_n(&map_bytes, __ATOMIC_RELAXED), v;
+
+	do {
+		v = ((bytes < 0) && (m < (unsigned long)-bytes)) ? 0 : m + bytes;
+	} while (!__atomic_compare_exchange_n(&map_bytes, &m, v, 1, __ATOMIC_RELAXED,
+	                                      __ATOMIC_RELAXED));
+
+	if (bytes > 0) raise_max(&map_peak, v);
+}
+
+static void map_call(int op, void* p, size_t size, void* res, long bytes,
+                     void* caller)
+{
+	shard* s;
+
+	// the tracer maps its own metadata while busy
+	if (!HAVE_TABLE || ((s = enter()) == NULL)) return;
+
+	log_event(s, op, 0, p, 1, size, res, clock_ticks());
+	__atomic_fetch_add(&n_os[op - EV_MMAP], 1, __ATOMIC_RELAXED);
+
+	if ((op == EV_BRK) || (op == EV_SBRK)) {
+		__atomic_fetch_add(&brk_bytes, bytes, __ATOMIC_RELAXED);
+	} else if (bytes != 0) {
+		map_add(bytes);
+	}
+	if (bytes > 0) site_alloc(locate(s->maps, caller), 1, bytes);
+
+	leave();
+}
+
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) {
+	void* res;
+
+	res = mmapp(addr, len, prot, flags, fd, off);
+	map_call(EV_MMAP, (void*)((uintptr_t)prot | (uintptr_t)flags << 8), len, res,
+	         res != MAP_FAILED ? (long)page_round(len) : 0,
+	         __builtin_return_address(0));
+
+	return res;
+}
+
+#ifdef __LP64__
+// same as mmap where off_t is 64 bits wide
+void* mmap64(void* addr, size_t len, int prot, int flags, int fd, off64_t off) {
+	void* res;
+
+	res = mmapp(addr, len, prot, flags, fd, off);
+	map_call(EV_MMAP, (void*)((uintptr_t)prot | (uintptr_t)flags << 8), len, res,
+	         res != MAP_FAILED ? (long)page_round(len) : 0,
+	         __builtin_return_address(0));
+
+	return res;
+}
+#endif
+
+int munmap(void* addr, size_t len) {
+	int res;
+
+	res = munmapp(addr, len);
+	map_call(EV_MUNMAP, addr, len, NULL, res == 0 ? -(long)page_round(len) : 0,
+	         __builtin_return_address(0));
+
+	return res;
+}
+
+void* mremap(void* old, size_t old_len, size_t len, int flags, ...) {
+	va_list ap;
+	void* new = NULL;
+	void* res;
+
+	if (flags & MREMAP_FIXED) {
+		va_start(ap, flags);
+		new = va_arg(ap, void*);
+		va_end(ap);
+	}
+
+	res = mremapp(old, old_len, len, flags, new);
+	map_call(EV_MREMAP, old, len, res,
+	         res != MAP_FAILED ? (long)page_round(len) - (long)page_round(old_len) : 0,
+	         __builtin_return_address(0));
+
+	return res;
+}
+
+int brk(void* addr) {
+	char* before = sbrkp(0);
+	long bytes;
+	int res;
+
+	res = brkp(addr);
+	bytes = (char*)sbrkp(0) - before;
+	map_call(EV_BRK, addr, (size_t)bytes, (void*)(intptr_t)res, bytes,
+	         __builtin_return_address(0));
+
+	return res;
+}
+
+void* sbrk(intptr_t incr) {
+	void* res;
+
+	res = sbrkp(incr);
+	map_call(EV_SBRK, NULL, (size_t)incr, res, res != (void*)-1 ? (long)incr : 0,
+	         __builtin_return_address(0));
+
+	return res;
+}
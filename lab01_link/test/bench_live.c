@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//
+// per-operation cost of malloc/free as the number of live blocks grows.
+// Run with the tracer preloaded; with a constant-time block table the
+// reported ns/op should stay flat across rows.
+//
+
+#define MAX_LIVE (1<<18)
+#define OPS      (1<<14)
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void)
+{
+  static void *live[MAX_LIVE];
+  void *a[16];
+  size_t n = 0, target;
+  double t;
+  int i, j;
+
+  printf("%10s   %10s\n", "live", "ns/op");
+
+  for (target = 1<<10; target <= MAX_LIVE; target <<= 1) {
+    for (; n < target; n++) live[n] = malloc(16 + n % 64);
+
+    t = now();
+    for (i = 0; i < OPS; i += 16) {
+      for (j = 0; j < 16; j++) a[j] = malloc(32);
+      for (j = 0; j < 16; j++) free(a[j]);
+    }
+    t = now() - t;
+
+    printf("%10zu   %10.1f\n", n, t / (2 * OPS));
+    fflush(stdout);
+  }
+
+  while (n > 0) free(live[--n]);
+
+  return 0;
+}
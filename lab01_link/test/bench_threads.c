@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// multi-threaded allocation workloads at 1..N threads
+//
+//   churn      random frees and allocations of small objects
+//   prodcons   every thread allocates blocks that the next thread frees
+//   realloc    buffers grown with realloc from 16 bytes to 64 KB
+//   longlived  a heap of LIVE blocks of which ALLOCS are replaced at random
+//
+// The workloads run twice, in child processes with and without the tracer,
+// so both columns come from one run:
+//
+//   make run bench_threads        (in part3)
+//
+// The traced column is empty if no tracer is preloaded. If MEMTRACE_LOG is
+// not set, the traced run writes a compressed event file to keep it small.
+// BENCH_THREADS sets N (default: number of CPUs, at least 4).
+//
+// ns/alloc is wall time times threads per allocation (realloc counts as an
+// allocation): it stays flat if the workload scales with the threads and
+// grows with contention.
+//
+
+#define ALLOCS    (1<<19)           // allocations per workload and run
+#define LIVE      (1<<21)           // blocks of the long-lived heap
+#define SLOTS     64                // live blocks per thread in churn
+#define RING      256               // blocks in flight per thread in prodcons
+#define MAX_THREADS 64
+
+typedef struct {
+  int id;
+  int threads;
+  unsigned int seed;
+} worker;
+
+typedef struct {
+  const char *name;
+  void *(*run)(void *);
+} workload;
+
+static pthread_barrier_t start;
+
+static inline unsigned int rnd(unsigned int *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+static void *churn(void *arg)
+{
+  worker *w = arg;
+  void *slot[SLOTS] = { NULL };
+  int i, n = ALLOCS / w->threads;
+
+  pthread_barrier_wait(&start);
+
+  for (i = 0; i < n; i++) {
+    unsigned int r = rnd(&w->seed);
+
+    free(slot[r % SLOTS]);
+    slot[r % SLOTS] = malloc(16 + (r >> 8) % 240);
+  }
+
+  for (i = 0; i < SLOTS; i++) free(slot[i]);
+
+  return NULL;
+}
+
+//
+// prodcons: ring i is filled by thread i and emptied by thread i+1
+//
+static struct ring {
+  void *slot[RING];
+  volatile unsigned long head __attribute__((aligned(64)));
+  volatile unsigned long tail __attribute__((aligned(64)));
+} ring[MAX_THREADS];
+
+static int push(struct ring *r, void *p)
+{
+  unsigned long h = r->head;
+
+  if (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING) return 0;
+  r->slot[h % RING] = p;
+  __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+static void *pop(struct ring *r)
+{
+  unsigned long t = r->tail;
+  void *p;
+
+  if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == t) return NULL;
+  p = r->slot[t % RING];
+  __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+
+  return p;
+}
+
+static void *prodcons(void *arg)
+{
+  worker *w = arg;
+  struct ring *out = &ring[w->id];
+  struct ring *in = &ring[(w->id + w->threads - 1) % w->threads];
+  int n = ALLOCS / w->threads, produced = 0, consumed = 0;
+  void *p = NULL, *q;
+
+  pthread_barrier_wait(&start);
+
+  while ((produced < n) || (consumed < n)) {
+    int idle = 1;
+
+    if ((produced < n) && (p == NULL)) p = malloc(32 + rnd(&w->seed) % 96);
+    if ((p != NULL) && push(out, p)) {
+      p = NULL;
+      produced++;
+      idle = 0;
+    }
+    if ((consumed < n) && ((q = pop(in)) != NULL)) {
+      free(q);
+      consumed++;
+      idle = 0;
+    }
+    if (idle) sched_yield();
+  }
+
+  return NULL;
+}
+
+static void *grow(void *arg)
+{
+  worker *w = arg;
+  int n = ALLOCS / w->threads, i = 0;
+  size_t size;
+  void *p;
+
+  pthread_barrier_wait(&start);
+
+  while (i < n) {
+    p = NULL;
+    for (size = 16; (size <= 65536) && (i < n); size += size / 2, i++) {
+      p = realloc(p, size);
+      ((char *)p)[size - 1] = 1;
+    }
+    free(p);
+  }
+
+  return NULL;
+}
+
+static void *longlived(void *arg)
+{
+  worker *w = arg;
+  int n = LIVE / w->threads, i;
+  void **heap = malloc(n * sizeof(void *));
+
+  pthread_barrier_wait(&start);
+
+  for (i = 0; i < n; i++) heap[i] = malloc(16 + rnd(&w->seed) % 48);
+  for (i = 0; i < ALLOCS / w->threads; i++) {
+    unsigned int r = rnd(&w->seed) % n;
+
+    free(heap[r]);
+    heap[r] = malloc(16 + rnd(&w->seed) % 48);
+  }
+  for (i = 0; i < n; i++) free(heap[i]);
+
+  free(heap);
+
+  return NULL;
+}
+
+static workload workloads[] = {
+  { "churn",     churn },
+  { "prodcons",  prodcons },
+  { "realloc",   grow },
+  { "longlived", longlived },
+};
+
+#define N_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long allocs(int wl, int threads)
+{
+  long n = (ALLOCS / threads) * (long)threads;
+
+  return wl == 3 ? n + (LIVE / threads) * (long)threads : n;
+}
+
+static int max_threads(void)
+{
+  const char *env = getenv("BENCH_THREADS");
+  long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (!env && (n < 4)) n = 4;
+  if (n < 1) n = 1;
+  if (n > MAX_THREADS) n = MAX_THREADS;
+
+  return (int)n;
+}
+
+//
+// run all workloads and print "<workload> <threads> <ns/alloc>" per line
+//
+static void bench(int nmax)
+{
+  pthread_t tid[MAX_THREADS];
+  worker w[MAX_THREADS];
+  double t;
+  int wl, n, i;
+
+  for (wl = 0; wl < N_WORKLOADS; wl++) {
+    for (n = 1; n <= nmax; n = (n < nmax && 2 * n > nmax) ? nmax : 2 * n) {
+      memset(ring, 0, sizeof(ring));
+      pthread_barrier_init(&start, NULL, n + 1);
+      for (i = 0; i < n; i++) {
+        w[i] = (worker){ i, n, 12345u + i };
+        pthread_create(&tid[i], NULL, workloads[wl].run, &w[i]);
+      }
+
+      pthread_barrier_wait(&start);
+      t = now();
+      for (i = 0; i < n; i++) pthread_join(tid[i], NULL);
+      t = now() - t;
+      pthread_barrier_destroy(&start);
+
+      printf("%s %d %.1f\n", workloads[wl].name, n, t * n / allocs(wl, n));
+      fflush(stdout);
+    }
+  }
+}
+
+//
+// run the workloads in a child process, with or without the tracer, and
+// read its results into ns[workload][threads]
+//
+static int measure(const char *self, int traced, int nmax,
+                   double ns[][MAX_THREADS + 1])
+{
+  char name[32];
+  double v;
+  int fd[2], status, wl, n;
+  pid_t pid;
+  FILE *in;
+
+  if (pipe(fd) != 0) return -1;
+
+  if ((pid = fork()) == 0) {
+    dup2(fd[1], STDOUT_FILENO);
+    close(fd[0]);
+    close(fd[1]);
+    if (!traced) unsetenv("LD_PRELOAD");
+    else setenv("MEMTRACE_LOG", "compressed", 0);
+    execl(self, self, "-child", NULL);
+    _exit(127);
+  }
+  close(fd[1]);
+  if (pid < 0) return -1;
+
+  in = fdopen(fd[0], "r");
+  while (fscanf(in, "%31s %d %lf", name, &n, &v) == 3) {
+    for (wl = 0; wl < N_WORKLOADS; wl++) {
+      if ((strcmp(name, workloads[wl].name) == 0) && (n <= nmax)) ns[wl][n] = v;
+    }
+  }
+  fclose(in);
+
+  return (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) &&
+         (WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  static double plain[N_WORKLOADS][MAX_THREADS + 1];
+  static double traced[N_WORKLOADS][MAX_THREADS + 1];
+  const char *preload = getenv("LD_PRELOAD");
+  int nmax = max_threads(), tracing, wl, n;
+
+  if ((argc > 1) && (strcmp(argv[1], "-child") == 0)) {
+    bench(nmax);
+    return 0;
+  }
+
+  tracing = (preload != NULL) && (preload[0] != '\0');
+
+  if ((measure("/proc/self/exe", 0, nmax, plain) != 0) ||
+      (tracing && (measure("/proc/self/exe", 1, nmax, traced) != 0))) {
+    fprintf(stderr, "bench_threads: a benchmark run failed\n");
+    return 1;
+  }
+
+  printf("%-10s %7s   %10s   %10s   %8s\n", "workload", "threads",
+         "untraced", "traced", "overhead");
+  printf("%-10s %7s   %10s   %10s\n", "", "", "ns/alloc", "ns/alloc");
+  for (wl = 0; wl < N_WORKLOADS; wl++) {
+    for (n = 1; n <= nmax; n++) {
+      if (plain[wl][n] == 0) continue;
+      printf("%-10s %7d   %10.1f", workloads[wl].name, n, plain[wl][n]);
+      if (tracing && (traced[wl][n] > 0)) {
+        printf("   %10.1f   %7.1fx", traced[wl][n], traced[wl][n] / plain[wl][n]);
+      }
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
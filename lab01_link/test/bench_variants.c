@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+// per-call cost of the allocation functions for a few block sizes. Run it
+// once without a tracer and once per memtrace variant (make bench in part3);
+// the difference of the rows is the overhead of tracing.
+//
+
+#define OPS   (1<<18)
+#define BATCH 64
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t sizes[] = { 16, 64, 256, 1024 };
+  const char *label = argc > 1 ? argv[1] : "";
+  void *a[BATCH];
+  double t, best;
+  size_t s;
+  int i, j, r;
+
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    // best of three rounds to hide the warm-up of the allocator
+    best = 0;
+    for (r = 0; r < 3; r++) {
+      t = now();
+      for (i = 0; i < OPS; i += BATCH) {
+        for (j = 0; j < BATCH; j++) a[j] = malloc(sizes[s]);
+        for (j = 0; j < BATCH; j++) free(a[j]);
+      }
+      t = (now() - t) / (2 * OPS);
+      if ((r == 0) || (t < best)) best = t;
+    }
+
+    printf("%-12s %8zu   %8.1f ns/call\n", label, sizes[s], best);
+    fflush(stdout);
+  }
+
+  return 0;
+}
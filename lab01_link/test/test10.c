@@ -0,0 +1,65 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#define N 1000
+#define Q 64
+
+//
+// producer/consumer pipeline: the producer allocates messages that the
+// consumer frees
+//
+static void *queue[Q];
+static int head = 0, tail = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+void *producer(void *arg)
+{
+  int i;
+
+  for (i = 0; i < N; i++) {
+    void *m = malloc(32 + i % 64);
+
+    pthread_mutex_lock(&lock);
+    while (head - tail == Q) pthread_cond_wait(&cond, &lock);
+    queue[head++ % Q] = m;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    // some blocks stay with the producer
+    if (i % 10 == 0) free(malloc(128));
+  }
+
+  return NULL;
+}
+
+void *consumer(void *arg)
+{
+  int i;
+
+  for (i = 0; i < N; i++) {
+    void *m;
+
+    pthread_mutex_lock(&lock);
+    while (head == tail) pthread_cond_wait(&cond, &lock);
+    m = queue[tail++ % Q];
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+
+    free(m);
+  }
+
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t p, c;
+
+  pthread_create(&p, NULL, producer, NULL);
+  pthread_create(&c, NULL, consumer, NULL);
+  pthread_join(p, NULL);
+  pthread_join(c, NULL);
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define N 10000
+
+//
+// pool candidates: nodes of a fixed size that are freed right away, and
+// buffers of varying size that live long
+//
+struct node {
+  struct node *next;
+  int key;
+  char payload[40];
+};
+
+static struct node *visit(int key)
+{
+  struct node *n = malloc(sizeof(struct node));
+
+  n->next = NULL;
+  n->key = key;
+  memset(n->payload, key, sizeof(n->payload));
+
+  return n;
+}
+
+int main(void)
+{
+  void *keep[N / 100];
+  struct node *n;
+  int i, sum = 0;
+
+  for (i = 0; i < N; i++) {
+    n = visit(i);
+    sum += n->key;
+    free(n);
+
+    if (i % 100 == 0) keep[i / 100] = malloc(16 + i);
+  }
+
+  for (i = 0; i < N / 100; i++) free(keep[i]);
+
+  return sum == 0;
+}
@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define N 20000
+#define KEEP 64
+
+//
+// fragmentation after a load spike: many small blocks are allocated and all
+// but every KEEP-th are freed, so each survivor pins a mostly empty page
+//
+int main(void)
+{
+  static void *spike[N];
+  int i;
+
+  for (i = 0; i < N; i++) {
+    spike[i] = malloc(48);
+    memset(spike[i], i, 48);
+  }
+
+  for (i = 0; i < N; i++) {
+    if (i % KEEP != 0) free(spike[i]);
+  }
+
+  // a few full pages of long-lived data
+  for (i = 0; i < 4; i++) memset(malloc(4000), 0, 4000);
+
+  // the survivors are still live at exit
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#define T 4
+#define N 100
+
+static void *a[T][N];
+static pthread_barrier_t barrier;
+
+void *worker(void *arg)
+{
+  long t = (long)arg;
+  int i;
+
+  for (i = 0; i < N; i++) a[t][i] = malloc(16);
+
+  pthread_barrier_wait(&barrier);
+
+  // free own odd blocks and the next thread's even blocks
+  for (i = 0; i < N; i += 2) {
+    free(a[t][i+1]);
+    free(a[(t+1) % T][i]);
+  }
+
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t tid[T];
+  long t;
+
+  pthread_barrier_init(&barrier, NULL, T);
+
+  for (t = 0; t < T; t++) pthread_create(&tid[t], NULL, worker, (void*)t);
+  for (t = 0; t < T; t++) pthread_join(tid[t], NULL);
+
+  return 0;
+}
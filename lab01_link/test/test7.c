@@ -0,0 +1,25 @@
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <stdlib.h>
+
+int main(void)
+{
+  void *a, *b, *c, *d, *e;
+
+  posix_memalign(&a, 64, 100);
+  b = aligned_alloc(4096, 8192);
+  c = memalign(32, 10);
+  d = valloc(100);
+  e = reallocarray(NULL, 10, 16);
+  e = reallocarray(e, 20, 16);
+
+  malloc_usable_size(a);
+
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+#include <new>
+#include <vector>
+
+struct alignas(64) line {
+  char data[64];
+};
+
+int main(void)
+{
+  int *i = new int(1);
+  int *a = new int[100];
+  line *l = new line;
+  line *m = new line[4];
+  int *n = new (std::nothrow) int[10];
+  std::vector<int> *v = new std::vector<int>(1000);
+
+  delete i;
+  delete[] a;
+  delete l;
+  delete[] m;
+  delete[] n;
+  delete v;
+
+  return 0;
+}
@@ -0,0 +1,28 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int main(void)
+{
+  void *a, *b, *c, *h;
+
+  a = mmap(NULL, 1 << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  b = mmap(NULL, 100, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  a = mremap(a, 1 << 20, 2 << 20, MREMAP_MAYMOVE);
+  memset(a, 1, 4096);
+
+  h = sbrk(4096);
+  sbrk(-4096);
+
+  c = malloc(1 << 20);
+  free(c);
+
+  munmap(b, 100);
+  munmap(a, 2 << 20);
+
+  (void)h;
+  return 0;
+}
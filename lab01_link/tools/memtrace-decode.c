@@ -0,0 +1,334 @@
+//------------------------------------------------------------------------------
+//
+// memtrace-decode
+//
+// analyze an event file recorded by memtrace (MEMTRACE_LOG=binary or
+// compressed)
+//
+//   memtrace-decode [-l] [-r <file.rep>] [-w <window>] [-j <threads>]
+//                   [-s <ms>] <trace>
+//
+//   -l         list all calls in the format of MEMTRACE_LOG=text
+//   -r         export the trace in the format of the malloc lab driver
+//              (lab03_malloc/traces/*.rep) to <file.rep>
+//   -w         size of the reorder window in events
+//   -j         number of chunks of a compressed trace decoded in parallel
+//   -s         skip to <ms> milliseconds after the start of the trace. Blocks
+//              allocated before are unknown, so their deallocations are
+//              ignored.
+//
+// The statistics and non-deallocated blocks are reported like memtrace does
+// at the end of a traced run.
+//
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "memlist.h"
+#include "memlog.h"
+#include "tracefile.h"
+
+//
+// export to the malloc lab trace format
+//
+// Every block gets the lowest id not used by another live block, so the
+// number of ids equals the peak number of live blocks. ids is a block table
+// whose size field holds the id of a block.
+//
+typedef struct __rep {
+  FILE *ops;
+  item *ids;
+  int *free_ids;
+  int n_free;
+  int max_free;
+  int n_ids;
+  int n_ops;
+  size_t live;
+  size_t peak;
+} rep;
+
+static int rep_id(rep *r)
+{
+  int *f;
+
+  if (r->n_free > 0) return r->free_ids[--r->n_free];
+
+  if (r->n_ids == r->max_free) {
+    r->max_free = r->max_free ? 2 * r->max_free : 1024;
+    f = realloc(r->free_ids, r->max_free * sizeof(int));
+    if (f == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    r->free_ids = f;
+  }
+
+  return r->n_ids++;
+}
+
+static void rep_alloc(rep *r, void *ptr, size_t size)
+{
+  int id = rep_id(r);
+
+  alloc(r->ids, ptr, id);
+  fprintf(r->ops, "a %d %zu\n", id, size);
+  r->n_ops++;
+
+  r->live += size;
+  if (r->live > r->peak) r->peak = r->live;
+}
+
+static void rep_free(rep *r, void *ptr, size_t size)
+{
+  item *i = dealloc(r->ids, ptr);
+
+  fprintf(r->ops, "f %zu\n", i->size);
+  r->n_ops++;
+  r->free_ids[r->n_free++] = (int)i->size;
+
+  r->live -= size;
+}
+
+static void rep_realloc(rep *r, void *p, size_t old_size, void *ptr,
+                        size_t size)
+{
+  item *i = dealloc(r->ids, p);
+
+  alloc(r->ids, ptr, i->size);
+  fprintf(r->ops, "r %zu %zu\n", i->size, size);
+  r->n_ops++;
+
+  r->live += size - old_size;
+  if (r->live > r->peak) r->peak = r->live;
+}
+
+static int rep_write(rep *r, const char *path)
+{
+  FILE *f;
+  char buf[65536];
+  size_t n;
+
+  if ((f = fopen(path, "w")) == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  fprintf(f, "%zu\n%d\n%d\n%d\n", r->peak, r->n_ids, r->n_ops, 1);
+
+  rewind(r->ops);
+  while ((n = fread(buf, 1, sizeof(buf), r->ops)) > 0) fwrite(buf, 1, n, f);
+
+  return fclose(f);
+}
+
+//
+// replay the events of a trace against a block table the same way memtrace
+// does at run time
+//
+static void decode(tracefile *t, bool list, rep *r)
+{
+  unsigned long n_malloc = 0, n_calloc = 0, n_realloc = 0;
+  unsigned long n_memalign = 0, n_new = 0;
+  unsigned long n_allocb = 0, n_freeb = 0;
+  long n_alloc_total, avg_allocb;
+  item *blocks = new_list();
+  item *node;
+  const event *e;
+  void *p, *res;
+  size_t old_size, nmemb;
+  bool found = false;
+
+  if (list) LOG_START();
+
+  while ((e = trace_next(t)) != NULL) {
+    p = (void*)(uintptr_t)e->ptr;
+    res = (void*)(uintptr_t)e->res;
+
+    switch (e->op) {
+      case EV_MALLOC:
+      case EV_CALLOC:
+      case EV_MEMALIGN:
+      case EV_NEW:
+        switch (e->op) {
+          case EV_MALLOC:
+            if (list) LOG_MALLOC((size_t)e->size, res);
+            n_malloc++;
+            break;
+          case EV_CALLOC:
+            nmemb = e->ptr ? (size_t)e->ptr : 1;
+            if (list) LOG_CALLOC(nmemb, (size_t)e->size / nmemb, res);
+            n_calloc++;
+            break;
+          case EV_MEMALIGN:
+            if (list) LOG_MEMALIGN((size_t)e->ptr, (size_t)e->size, res);
+            n_memalign++;
+            break;
+          case EV_NEW:
+            if (list) LOG_NEW((size_t)e->ptr, (size_t)e->size, res);
+            n_new++;
+            break;
+        }
+
+        if (res != NULL) {
+          n_allocb += e->size;
+          alloc(blocks, res, e->size);
+          if (r) rep_alloc(r, res, e->size);
+        }
+        break;
+
+      case EV_REALLOC:
+        if (list) LOG_REALLOC(p, (size_t)e->size, res);
+        if (e->flags & EVF_DOUBLE_FREE) {
+          if (list) LOG_DOUBLE_FREE();
+          break;
+        }
+        n_realloc++;
+
+        node = p ? find(blocks, p) : NULL;
+        if ((node != NULL) && (node->cnt <= 0)) node = NULL;
+
+        if ((res == NULL) && (e->size != 0)) break;   // failed, p unchanged
+
+        if (node != NULL) {
+          old_size = node->size;
+          n_freeb += old_size;
+          dealloc(blocks, p);
+        }
+        if (res != NULL) {
+          n_allocb += e->size;
+          alloc(blocks, res, e->size);
+        }
+
+        if (r) {
+          if ((node != NULL) && (res != NULL)) {
+            rep_realloc(r, p, old_size, res, e->size);
+          } else if (node != NULL) {
+            rep_free(r, p, old_size);
+          } else if (res != NULL) {
+            rep_alloc(r, res, e->size);
+          }
+        }
+        break;
+
+      case EV_FREE:
+      case EV_DELETE:
+        if (list) {
+          if (e->op == EV_FREE) LOG_FREE(p);
+          else LOG_DELETE(p);
+          if (e->flags & EVF_DOUBLE_FREE) LOG_DOUBLE_FREE();
+          if (e->flags & EVF_ILLEGAL_FREE) LOG_ILL_FREE();
+        }
+        if ((p == NULL) || e->flags) break;
+
+        node = find(blocks, p);
+        if ((node == NULL) || (node->cnt <= 0)) break;
+
+        n_freeb += node->size;
+        dealloc(blocks, p);
+        if (r) rep_free(r, p, node->size);
+        break;
+
+      // OS-level calls are only listed
+      case EV_MMAP:
+        if (list) LOG_MMAP((size_t)e->size, (int)(e->ptr & 0xff),
+                           (int)(e->ptr >> 8), res);
+        break;
+      case EV_MUNMAP:
+        if (list) LOG_MUNMAP(p, (size_t)e->size);
+        break;
+      case EV_MREMAP:
+        if (list) LOG_MREMAP(p, (size_t)e->size, res);
+        break;
+      case EV_BRK:
+        if (list) LOG_BRK(p, (int)(intptr_t)res);
+        break;
+      case EV_SBRK:
+        if (list) LOG_SBRK((long)e->size, res);
+        break;
+    }
+  }
+
+  n_alloc_total = n_malloc + n_calloc + n_realloc + n_memalign + n_new;
+  avg_allocb = n_alloc_total ? n_allocb / n_alloc_total : 0;
+
+  LOG_STATISTICS(n_allocb, avg_allocb, n_freeb);
+
+  node = blocks;
+  while ((node = node->next) != NULL) {
+    if (node->cnt > 0) {
+      if (!found) {
+        LOG_NONFREED_START();
+        found = true;
+      }
+      LOG_BLOCK(node->ptr, node->size, node->cnt);
+    }
+  }
+
+  if (list) LOG_STOP();
+
+  free_list(blocks);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-l] [-r <file.rep>] [-w <window>] [-j <threads>] "
+                  "[-s <ms>] <trace>\n"
+                  "\n"
+                  "  -l         list all calls\n"
+                  "  -r         export to a malloc lab trace file\n"
+                  "  -w         size of the reorder window in events "
+                  "(default %d)\n"
+                  "  -j         number of decoding threads for compressed "
+                  "traces (default: CPUs)\n"
+                  "  -s         start at <ms> milliseconds into the trace\n",
+          prog, TRACE_WINDOW);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *rep_path = NULL;
+  bool list = false;
+  size_t window = 0;
+  int threads = 0;
+  long start = -1;
+  tracefile t;
+  rep r = { 0 };
+  int c;
+
+  while ((c = getopt(argc, argv, "lr:w:j:s:")) != -1) {
+    switch (c) {
+      case 'l': list = true; break;
+      case 'r': rep_path = optarg; break;
+      case 'w': window = strtoul(optarg, NULL, 0); break;
+      case 'j': threads = atoi(optarg); break;
+      case 's': start = strtol(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) usage(argv[0]);
+
+  if (trace_open(&t, argv[optind], window, threads) != 0) return EXIT_FAILURE;
+  if (start >= 0) trace_seek(&t, (uint64_t)start * 1000000);
+
+  if (rep_path) {
+    r.ops = tmpfile();
+    r.ids = new_list();
+    if ((r.ops == NULL) || (r.ids == NULL)) {
+      perror("tmpfile");
+      return EXIT_FAILURE;
+    }
+  }
+
+  mlog_stream(stdout);
+  decode(&t, list, rep_path ? &r : NULL);
+
+  trace_close(&t);
+
+  if (rep_path && (rep_write(&r, rep_path) != 0)) return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,641 @@
+//------------------------------------------------------------------------------
+//
+// memtrace-replay
+//
+// replay the allocation calls of an event file recorded by memtrace
+// (MEMTRACE_LOG=binary or compressed) against an allocator and measure it
+//
+//   memtrace-replay [-a libc|mm] [-m fast|order|time] [-w <window>]
+//                   [-j <threads>] <trace>
+//
+//   -a         allocator: 'libc' (default) calls malloc and friends, i.e.,
+//              glibc or whatever allocator is LD_PRELOADed; 'mm' calls
+//              mm_malloc, mm_free and mm_realloc of the malloc lab
+//              (lab03_malloc)
+//   -m         'fast' (default): every thread of the trace is replayed by a
+//              thread of its own that runs as fast as it can; a thread only
+//              waits for blocks that another thread allocates. 'order': the
+//              calls are made one at a time in the order of the trace, i.e.,
+//              with the original interleaving of the threads. 'time': like
+//              'order', and no call is made before its original time.
+//   -w         size of the reorder window in events
+//   -j         number of chunks of a compressed trace decoded in parallel
+//
+// Every recorded thread is replayed by a thread of its own. Blocks are
+// identified by their allocation, not by their address, so a block freed by
+// another thread than the one that allocated it is freed by the
+// corresponding replay threads. Calls that failed in the trace and calls on
+// blocks allocated before the trace started are skipped. Every page of an
+// allocated block is touched once (outside of the timed call) so that the
+// resident set grows like the traced program's.
+//
+// The allocators of the malloc lab are not thread-safe: with '-a mm' all
+// calls are made by one thread in the order of the trace. They do not
+// support alignment either; aligned requests are served by mm_malloc.
+//
+// The throughput, the peak resident set size and the latency percentiles per
+// call type and size class are reported like memtrace does with
+// MEMTRACE_LATENCY=1.
+//
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memclock.h"
+#include "memlat.h"
+#include "memlist.h"
+#include "memlog.h"
+#include "memlib.h"
+#include "mm.h"
+#include "tracefile.h"
+
+#define NO_BLOCK        UINT32_MAX
+#define PAGE_SIZE       4096
+#define SPIN_NS         100000        // sleep instead of spinning if further ahead
+#define MM_HEAP         (1UL << 30)   // simulated heap of mm_malloc, at most
+
+enum { ALLOC_LIBC, ALLOC_MM };
+enum { MODE_FAST, MODE_ORDER, MODE_TIME };
+
+static const char *alloc_name[] = { "libc", "mm" };
+static const char *mode_name[] = { "fast", "order", "time" };
+
+static const char *op_name[LAT_OPS] = {
+  "", "malloc", "calloc", "realloc", "free", "memalign", "operator new",
+  "operator delete"
+};
+
+//
+// a call to replay
+//
+//   op         call type (EV_*)
+//   thread     replay thread
+//   ns         time of the call since the first call of the trace
+//   size       requested size (size of the freed block for free and delete)
+//   align      requested alignment (memalign, new; 0 for unaligned new)
+//   block      block allocated by the call or NO_BLOCK
+//   old        block freed or reallocated by the call or NO_BLOCK
+//
+typedef struct __call {
+  uint8_t op;
+  uint32_t thread;
+  uint64_t ns;
+  uint64_t size;
+  uint64_t align;
+  uint32_t block;
+  uint32_t old;
+} call;
+
+//
+// a block allocated by the replay
+//
+//   ptr        pointer returned by the allocator (NULL if it failed)
+//   size       requested size
+//   ready      set once ptr is valid
+//
+typedef struct __block {
+  void *ptr;
+  uint64_t size;
+  int ready;
+} block;
+
+//
+// a replay thread
+//
+//   tid        thread id in the trace
+//   calls      indices of the calls of this thread, in trace order
+//   n, cap     number of calls and capacity of calls
+//   lat        latency of the calls
+//   ticks      total time spent in the allocator
+//   failed     number of failed allocations
+//
+typedef struct __worker {
+  uint32_t tid;
+  size_t *calls;
+  size_t n, cap;
+  latency lat;
+  uint64_t ticks;
+  unsigned long failed;
+  pthread_t th;
+} worker;
+
+static int allocator = ALLOC_LIBC;
+static int mode = MODE_FAST;
+
+static call *calls = NULL;
+static size_t n_calls = 0, cap_calls = 0;
+static block *blocks = NULL;
+static size_t n_blocks = 0, cap_blocks = 0;
+static worker **workers = NULL;
+static int n_workers = 0;
+
+static size_t turn = 0;
+static uint64_t start_ns = 0;
+
+static void *grow(void *p, size_t *cap, size_t size)
+{
+  *cap = *cap ? 2 * *cap : 65536;
+  if ((p = realloc(p, *cap * size)) == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+
+  return p;
+}
+
+//
+// simulated heap of mm_malloc (replaces memlib.c of the malloc lab)
+//
+// the allocators of the malloc lab store pointers in 32-bit words, so the
+// heap is mapped in the low 2 GB of the address space.
+//
+static char *mm_start = NULL, *mm_brk = NULL, *mm_end = NULL;
+
+void mem_init(void)
+{
+  size_t len = MM_HEAP;
+  void *p;
+
+  while ((p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_32BIT,
+                   -1, 0)) == MAP_FAILED) {
+    if ((len /= 2) < PAGE_SIZE) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  mm_start = mm_brk = p;
+  mm_end = mm_start + len;
+}
+
+void *mem_sbrk(int incr)
+{
+  char *old = mm_brk;
+
+  if ((incr < 0) || (incr > mm_end - mm_brk)) return (void*)-1;
+  mm_brk += incr;
+
+  return old;
+}
+
+void *mem_heap_lo(void)
+{
+  return mm_start;
+}
+
+void *mem_heap_hi(void)
+{
+  return mm_brk - 1;
+}
+
+size_t mem_heapsize(void)
+{
+  return mm_brk - mm_start;
+}
+
+size_t mem_pagesize(void)
+{
+  return PAGE_SIZE;
+}
+
+//
+// replay thread of a thread id of the trace
+//
+static uint32_t thread_of(uint32_t tid)
+{
+  static int last = 0;
+  worker *w;
+  int k;
+
+  if ((n_workers > 0) && (workers[last]->tid == tid)) return last;
+  for (k = 0; k < n_workers; k++) {
+    if (workers[k]->tid == tid) return last = k;
+  }
+
+  w = calloc(1, sizeof(worker));
+  workers = realloc(workers, (n_workers + 1) * sizeof(worker*));
+  if ((w == NULL) || (workers == NULL)) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  w->tid = tid;
+  workers[n_workers] = w;
+
+  return last = n_workers++;
+}
+
+static uint32_t new_block(uint64_t size)
+{
+  if (n_blocks == cap_blocks) blocks = grow(blocks, &cap_blocks, sizeof(block));
+  blocks[n_blocks].ptr = NULL;
+  blocks[n_blocks].size = size;
+  blocks[n_blocks].ready = 0;
+
+  return (uint32_t)n_blocks++;
+}
+
+static void add_call(tracefile *t, const event *e, uint64_t t0, int op,
+                     uint64_t size, uint64_t align, uint32_t block,
+                     uint32_t old)
+{
+  call *c;
+  int64_t ns = (int64_t)(trace_ns(t, e->tsc) - t0);
+
+  if (n_calls == cap_calls) calls = grow(calls, &cap_calls, sizeof(call));
+  c = &calls[n_calls++];
+  c->op = (uint8_t)op;
+  c->thread = thread_of(e->tid);
+  c->ns = ns > 0 ? (uint64_t)ns : 0;
+  c->size = size;
+  c->align = align;
+  c->block = block;
+  c->old = old;
+}
+
+//
+// read the allocation calls of a trace. ids maps the addresses of the live
+// blocks of the trace to blocks; the size field of an item holds the block.
+//
+static void load(tracefile *t)
+{
+  item *ids = new_list();
+  const event *e;
+  item *node;
+  void *p, *res;
+  uint32_t b, old;
+  uint64_t t0 = 0;
+  bool first = true;
+
+  while ((e = trace_next(t)) != NULL) {
+    if ((e->op < EV_MALLOC) || (e->op > EV_DELETE)) continue;
+    if (first) {
+      t0 = trace_ns(t, e->tsc);
+      first = false;
+    }
+
+    p = (void*)(uintptr_t)e->ptr;
+    res = (void*)(uintptr_t)e->res;
+
+    node = NULL;
+    if (((e->op == EV_REALLOC) || (e->op == EV_FREE) || (e->op == EV_DELETE)) &&
+        (p != NULL) && !(e->flags & (EVF_DOUBLE_FREE | EVF_ILLEGAL_FREE))) {
+      node = find(ids, p);
+      if ((node != NULL) && (node->cnt <= 0)) node = NULL;
+    }
+    old = node ? (uint32_t)node->size : NO_BLOCK;
+
+    switch (e->op) {
+      case EV_MALLOC:
+      case EV_CALLOC:
+      case EV_MEMALIGN:
+      case EV_NEW:
+        if (res == NULL) break;
+        b = new_block(e->size);
+        add_call(t, e, t0, e->op, e->size,
+                 (e->op == EV_MEMALIGN) || (e->op == EV_NEW) ? e->ptr : 0,
+                 b, NO_BLOCK);
+        alloc(ids, res, b);
+        break;
+
+      case EV_REALLOC:
+        if (e->flags & EVF_DOUBLE_FREE) break;
+        if ((res == NULL) && (e->size != 0)) break;   // failed, p unchanged
+
+        if (res == NULL) {
+          // realloc(p, 0) freed the block
+          if (node == NULL) break;
+          add_call(t, e, t0, EV_FREE, blocks[old].size, 0, NO_BLOCK, old);
+          dealloc(ids, p);
+          break;
+        }
+
+        b = new_block(e->size);
+        add_call(t, e, t0, EV_REALLOC, e->size, 0, b, old);
+        if (node != NULL) dealloc(ids, p);
+        alloc(ids, res, b);
+        break;
+
+      case EV_FREE:
+      case EV_DELETE:
+        if (node == NULL) break;
+        add_call(t, e, t0, e->op, blocks[old].size, 0, NO_BLOCK, old);
+        dealloc(ids, p);
+        break;
+    }
+  }
+
+  free_list(ids);
+}
+
+//
+// assign the calls to the replay threads
+//
+static void distribute(void)
+{
+  worker *w;
+  size_t i;
+
+  // the allocators of the malloc lab are single-threaded
+  if (allocator == ALLOC_MM) {
+    for (i = 0; i < n_calls; i++) calls[i].thread = 0;
+    while (n_workers > 1) free(workers[--n_workers]);
+    if (n_workers == 0) thread_of(0);
+  }
+
+  for (i = 0; i < n_calls; i++) {
+    w = workers[calls[i].thread];
+    if (w->n == w->cap) w->calls = grow(w->calls, &w->cap, sizeof(size_t));
+    w->calls[w->n++] = i;
+  }
+}
+
+//
+// make a call on the allocator under test
+//
+static void *do_alloc(int op, uint64_t size, uint64_t align, void *old)
+{
+  void *p = NULL;
+
+  if (allocator == ALLOC_MM) {
+    switch (op) {
+      case EV_REALLOC:
+        return mm_realloc(old, size);
+      case EV_FREE:
+      case EV_DELETE:
+        if (old != NULL) mm_free(old);
+        return NULL;
+      case EV_CALLOC:
+        if ((p = mm_malloc(size)) != NULL) memset(p, 0, size);
+        return p;
+      default:
+        return mm_malloc(size);
+    }
+  }
+
+  switch (op) {
+    case EV_MALLOC:
+      return malloc(size);
+    case EV_CALLOC:
+      return calloc(1, size);
+    case EV_REALLOC:
+      return realloc(old, size);
+    case EV_FREE:
+    case EV_DELETE:
+      free(old);
+      return NULL;
+    case EV_MEMALIGN:
+    case EV_NEW:
+      return align ? memalign(align, size) : malloc(size);
+  }
+
+  return NULL;
+}
+
+//
+// wait until the original time of a call
+//
+static void wait_time(uint64_t ns)
+{
+  struct timespec ts;
+  uint64_t now;
+
+  while ((now = clock_mono_ns() - start_ns) < ns) {
+    if (ns - now > SPIN_NS) {
+      ts.tv_sec = 0;
+      ts.tv_nsec = ns - now - SPIN_NS / 2;
+      if (ts.tv_nsec >= 1000000000L) ts.tv_nsec = 999999999L;
+      nanosleep(&ts, NULL);
+    }
+  }
+}
+
+static void *replay(void *arg)
+{
+  worker *w = arg;
+  uint64_t t0, ticks;
+  call *c;
+  void *old, *res;
+  size_t k, i, o;
+
+  for (k = 0; k < w->n; k++) {
+    i = w->calls[k];
+    c = &calls[i];
+
+    if (mode != MODE_FAST) {
+      while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) != i) sched_yield();
+    }
+    if (mode == MODE_TIME) wait_time(c->ns);
+
+    old = NULL;
+    if (c->old != NO_BLOCK) {
+      while (!__atomic_load_n(&blocks[c->old].ready, __ATOMIC_ACQUIRE)) sched_yield();
+      old = blocks[c->old].ptr;
+    }
+
+    // a block the allocator failed to allocate cannot be freed
+    if ((old == NULL) && (c->old != NO_BLOCK) && (c->block == NO_BLOCK)) {
+      res = NULL;
+    } else {
+      t0 = clock_ticks();
+      res = do_alloc(c->op, c->size, c->align, old);
+      ticks = clock_ticks() - t0;
+
+      w->ticks += ticks;
+      if (lat_record(&w->lat, c->op, c->size, ticks)) {
+        lat_slow(&w->lat, c->op, c->size, ticks, NULL);
+      }
+    }
+
+    if (c->block != NO_BLOCK) {
+      if (res == NULL) {
+        if (c->size > 0) w->failed++;
+      } else {
+        for (o = 0; o < c->size; o += PAGE_SIZE) ((volatile char*)res)[o] = 1;
+      }
+      blocks[c->block].ptr = res;
+      __atomic_store_n(&blocks[c->block].ready, 1, __ATOMIC_RELEASE);
+    }
+
+    if (mode != MODE_FAST) __atomic_store_n(&turn, i + 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+//
+// resident set size in kB: current (VmRSS) or peak (VmHWM)
+//
+static unsigned long rss_kb(const char *field)
+{
+  char line[256];
+  unsigned long kb = 0;
+  size_t len = strlen(field);
+  FILE *f;
+
+  if ((f = fopen("/proc/self/status", "r")) == NULL) return 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if ((strncmp(line, field, len) == 0) && (line[len] == ':')) {
+      kb = strtoul(line + len + 1, NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+
+  return kb;
+}
+
+//
+// reset the peak resident set size to the current one; returns false if the
+// kernel does not support it
+//
+static bool reset_peak_rss(void)
+{
+  FILE *f;
+  bool ok;
+
+  if ((f = fopen("/proc/self/clear_refs", "w")) == NULL) return false;
+  ok = fputs("5", f) >= 0;
+
+  return (fclose(f) == 0) && ok;
+}
+
+static void report(double secs, unsigned long rss, unsigned long base,
+                   bool peak_valid)
+{
+  latency *total;
+  unsigned long failed = 0, n;
+  uint64_t ticks = 0;
+  unsigned long *h;
+  int o, c, k;
+
+  if ((total = calloc(1, sizeof(latency))) == NULL) {
+    perror("calloc");
+    return;
+  }
+
+  for (k = 0; k < n_workers; k++) {
+    lat_merge(total, &workers[k]->lat);
+    failed += workers[k]->failed;
+    ticks += workers[k]->ticks;
+  }
+
+  LOG_REPLAY(alloc_name[allocator], mode_name[mode], n_workers,
+             (unsigned long)n_calls, failed, secs,
+             secs > 0 ? n_calls / secs : 0.0, clock_ns(ticks) / 1e9);
+  LOG_REPLAY_RSS(rss, base, peak_valid ? "" : " (includes loading the trace)");
+
+  LOG_LATENCY_START();
+  for (o = 0; o < LAT_OPS; o++) {
+    for (c = 0; c < LAT_CLASSES; c++) {
+      h = total->hist[o][c];
+      for (n = 0, k = 0; k < LAT_BUCKETS; k++) n += h[k];
+      if (n == 0) continue;
+
+      LOG_LATENCY(op_name[o], (unsigned long)lat_class_lower(c),
+                  c < LAT_CLASSES - 1 ? (unsigned long)lat_class_lower(c + 1) - 1 : ULONG_MAX,
+                  n,
+                  (unsigned long)clock_ns(lat_percentile(h, 0.5)),
+                  (unsigned long)clock_ns(lat_percentile(h, 0.99)),
+                  (unsigned long)clock_ns(lat_percentile(h, 0.999)));
+    }
+  }
+
+  free(total);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-a libc|mm] [-m fast|order|time] [-w <window>] "
+                  "[-j <threads>] <trace>\n"
+                  "\n"
+                  "  -a         allocator: libc (or LD_PRELOADed) or the "
+                  "malloc lab's mm\n"
+                  "  -m         fast: as fast as possible; order: original "
+                  "interleaving;\n"
+                  "             time: original interleaving and timing\n"
+                  "  -w         size of the reorder window in events "
+                  "(default %d)\n"
+                  "  -j         number of decoding threads for compressed "
+                  "traces (default: CPUs)\n",
+          prog, TRACE_WINDOW);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t window = 0;
+  int threads = 0;
+  unsigned long base, rss;
+  bool peak_valid;
+  uint64_t end_ns;
+  tracefile t;
+  int c, k;
+
+  while ((c = getopt(argc, argv, "a:m:w:j:")) != -1) {
+    switch (c) {
+      case 'a':
+        if (strcmp(optarg, "libc") == 0) allocator = ALLOC_LIBC;
+        else if (strcmp(optarg, "mm") == 0) allocator = ALLOC_MM;
+        else usage(argv[0]);
+        break;
+      case 'm':
+        if (strcmp(optarg, "fast") == 0) mode = MODE_FAST;
+        else if (strcmp(optarg, "order") == 0) mode = MODE_ORDER;
+        else if (strcmp(optarg, "time") == 0) mode = MODE_TIME;
+        else usage(argv[0]);
+        break;
+      case 'w': window = strtoul(optarg, NULL, 0); break;
+      case 'j': threads = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) usage(argv[0]);
+
+  clock_init();
+
+  if (trace_open(&t, argv[optind], window, threads) != 0) return EXIT_FAILURE;
+  load(&t);
+  trace_close(&t);
+
+  distribute();
+
+  if (allocator == ALLOC_MM) {
+    mem_init();
+    if (mm_init() != 0) {
+      fprintf(stderr, "mm_init failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  base = rss_kb("VmRSS");
+  peak_valid = reset_peak_rss();
+
+  start_ns = clock_mono_ns();
+  for (k = 1; k < n_workers; k++) {
+    if (pthread_create(&workers[k]->th, NULL, replay, workers[k]) != 0) {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_workers > 0) replay(workers[0]);
+  for (k = 1; k < n_workers; k++) pthread_join(workers[k]->th, NULL);
+  end_ns = clock_mono_ns();
+
+  rss = rss_kb("VmHWM");
+
+  mlog_stream(stdout);
+  report((end_ns - start_ns) / 1e9, rss, base, peak_valid);
+
+  return EXIT_SUCCESS;
+}
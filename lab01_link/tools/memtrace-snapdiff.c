@@ -0,0 +1,241 @@
+//------------------------------------------------------------------------------
+//
+// memtrace-snapdiff
+//
+// compare two heap snapshots written by memtrace (MEMTRACE_SNAPSHOT, see
+// memsnap.h)
+//
+//   memtrace-snapdiff [-a] [-n <sites>] <old.snap> <new.snap>
+//
+//   -a         also list the sites whose live heap shrank
+//   -n         number of sites to list (default 20)
+//
+// Sites are matched by their frame names, so snapshots of different runs of
+// the same program can be compared as well. The sites whose live bytes grew
+// the most are listed first; a site that keeps growing from snapshot to
+// snapshot is a leak candidate.
+//
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memsnap.h"
+
+//
+// live heap of one call site
+//
+//   frames     frame names, one per line
+//   blocks,
+//   bytes      live blocks and bytes of the site in the old/new snapshot
+//
+typedef struct __entry {
+  char *frames;
+  long blocks[2];
+  long bytes[2];
+} entry;
+
+//
+// a parsed snapshot
+//
+typedef struct __snapshot {
+  int pid;
+  unsigned long ns;
+  long bytes;
+  long blocks;
+  entry *e;
+  size_t n;
+  size_t max;
+} snapshot;
+
+static void *xrealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (p == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void add_frame(entry *e, const char *name)
+{
+  size_t old = e->frames ? strlen(e->frames) : 0;
+  size_t len = strlen(name);
+
+  e->frames = xrealloc(e->frames, old + len + 2);
+  memcpy(e->frames + old, name, len);
+  e->frames[old + len] = '\n';
+  e->frames[old + len + 1] = '\0';
+}
+
+static int read_snapshot(const char *path, snapshot *s, int which)
+{
+  FILE *f;
+  char line[1024];
+  unsigned long id;
+  long blocks, bytes;
+  int version;
+  entry *e = NULL;
+  size_t len;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if ((fgets(line, sizeof(line), f) == NULL) ||
+      (sscanf(line, "memtrace snapshot %d", &version) != 1) ||
+      (version != SNAP_VERSION)) {
+    fprintf(stderr, "%s: not a memtrace snapshot\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    len = strlen(line);
+    if ((len > 0) && (line[len - 1] == '\n')) line[len - 1] = '\0';
+
+    if (strncmp(line, "block ", 6) == 0) break;
+
+    if (sscanf(line, "site %lx %ld %ld", &id, &blocks, &bytes) == 3) {
+      if (s->n == s->max) {
+        s->max = s->max ? 2 * s->max : 256;
+        s->e = xrealloc(s->e, s->max * sizeof(entry));
+      }
+      e = &s->e[s->n++];
+      memset(e, 0, sizeof(entry));
+      e->blocks[which] = blocks;
+      e->bytes[which] = bytes;
+    } else if ((strncmp(line, "frame ", 6) == 0) && (e != NULL)) {
+      add_frame(e, line + 6);
+    } else {
+      sscanf(line, "pid %d", &s->pid);
+      sscanf(line, "time_ns %lu", &s->ns);
+      sscanf(line, "live_bytes %ld", &s->bytes);
+      sscanf(line, "live_blocks %ld", &s->blocks);
+    }
+  }
+
+  // sites without frames are blocks whose call site is unknown
+  for (len = 0; len < s->n; len++) {
+    if (s->e[len].frames == NULL) add_frame(&s->e[len], "(unknown)");
+  }
+
+  fclose(f);
+  return 0;
+}
+
+static int by_frames(const void *a, const void *b)
+{
+  return strcmp(((const entry*)a)->frames, ((const entry*)b)->frames);
+}
+
+static long delta(const entry *e)
+{
+  return e->bytes[1] - e->bytes[0];
+}
+
+static int by_delta(const void *a, const void *b)
+{
+  long x = delta(a), y = delta(b);
+
+  if (x != y) return x < y ? 1 : -1;
+  return 0;
+}
+
+//
+// merge the sites of both snapshots (sorted by frames) into one list
+//
+static entry *merge(snapshot *a, snapshot *b, size_t *n)
+{
+  entry *m = xrealloc(NULL, (a->n + b->n + 1) * sizeof(entry));
+  size_t i = 0, j = 0, k = 0;
+  int c;
+
+  qsort(a->e, a->n, sizeof(entry), by_frames);
+  qsort(b->e, b->n, sizeof(entry), by_frames);
+
+  while ((i < a->n) || (j < b->n)) {
+    if (i == a->n) c = 1;
+    else if (j == b->n) c = -1;
+    else c = by_frames(&a->e[i], &b->e[j]);
+
+    if (c < 0) m[k] = a->e[i++];
+    else if (c > 0) m[k] = b->e[j++];
+    else {
+      m[k] = a->e[i++];
+      m[k].blocks[1] = b->e[j].blocks[1];
+      m[k].bytes[1] = b->e[j++].bytes[1];
+    }
+    k++;
+  }
+
+  *n = k;
+  return m;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-a] [-n <sites>] <old.snap> <new.snap>\n"
+                  "\n"
+                  "  -a         also list sites that shrank\n"
+                  "  -n         number of sites to list (default 20)\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  snapshot a = { 0 }, b = { 0 };
+  entry *m;
+  size_t n, k;
+  int n_sites = 20, listed = 0;
+  bool all = false;
+  char *f, *nl;
+  int c;
+
+  while ((c = getopt(argc, argv, "an:")) != -1) {
+    switch (c) {
+      case 'a': all = true; break;
+      case 'n': n_sites = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2) usage(argv[0]);
+
+  if ((read_snapshot(argv[optind], &a, 0) != 0) ||
+      (read_snapshot(argv[optind + 1], &b, 1) != 0)) return EXIT_FAILURE;
+
+  printf("old: pid %d at %.3f s, %ld bytes in %ld blocks\n",
+         a.pid, a.ns / 1e9, a.bytes, a.blocks);
+  printf("new: pid %d at %.3f s, %ld bytes in %ld blocks\n",
+         b.pid, b.ns / 1e9, b.bytes, b.blocks);
+  printf("change: %+ld bytes, %+ld blocks\n\n", b.bytes - a.bytes,
+         b.blocks - a.blocks);
+
+  m = merge(&a, &b, &n);
+  qsort(m, n, sizeof(entry), by_delta);
+
+  printf("%14s %12s %14s %12s  %s\n", "delta bytes", "delta blocks",
+         "new bytes", "new blocks", "site");
+  for (k = 0; (k < n) && (listed < n_sites); k++) {
+    if ((delta(&m[k]) == 0) && (m[k].blocks[1] == m[k].blocks[0])) continue;
+    if (!all && (delta(&m[k]) <= 0)) continue;
+
+    f = m[k].frames;
+    nl = strchr(f, '\n');
+    printf("%+14ld %+12ld %14ld %12ld  %.*s\n", delta(&m[k]),
+           m[k].blocks[1] - m[k].blocks[0], m[k].bytes[1], m[k].blocks[1],
+           (int)(nl - f), f);
+    for (f = nl + 1; (nl = strchr(f, '\n')) != NULL; f = nl + 1) {
+      printf("%56s  %.*s\n", "", (int)(nl - f), f);
+    }
+    listed++;
+  }
+
+  return EXIT_SUCCESS;
+}
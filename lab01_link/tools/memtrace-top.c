@@ -0,0 +1,160 @@
+//------------------------------------------------------------------------------
+//
+// memtrace-top
+//
+// monitor the live statistics of a process traced by memtrace
+// (MEMTRACE_SHM, see memshm.h)
+//
+//   memtrace-top [-i <ms>] [-n <count>] [-s] <pid | file>
+//
+//   -i         interval between updates in milliseconds (default 1000)
+//   -n         stop after <count> updates (default: until the process exits)
+//   -s         also print the live blocks and bytes per size after each update
+//
+// A pid selects /dev/shm/memtrace.<pid>. Every update prints the live and
+// peak heap and the call and byte rates since the previous update.
+//
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memhist.h"
+#include "memshm.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-i <ms>] [-n <count>] [-s] <pid | file>\n"
+                  "\n"
+                  "  -i         interval between updates in milliseconds "
+                  "(default 1000)\n"
+                  "  -n         number of updates (default: until the process "
+                  "exits)\n"
+                  "  -s         print the live heap per size\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+static unsigned long n_allocs(const stats *st)
+{
+  return st->n_malloc + st->n_calloc + st->n_realloc + st->n_memalign +
+         st->n_new;
+}
+
+//
+// per-second rate of a counter between two snapshots
+//
+static double rate(unsigned long now, unsigned long prev, uint64_t ns)
+{
+  return ns ? (now - prev) * 1e9 / ns : 0.0;
+}
+
+static void print_header(const shm_stats *s)
+{
+  printf("memtrace-top: pid %d%s\n", s->pid,
+         s->sample ? " (sampled, values are estimates)" : "");
+  printf("%10s %14s %12s %14s %12s %12s %14s %14s\n",
+         "time [s]", "live bytes", "live blocks", "peak bytes",
+         "allocs/s", "frees/s", "alloc B/s", "free B/s");
+}
+
+static void print_line(const shm_stats *s, const shm_stats *prev)
+{
+  uint64_t ns = s->ns - prev->ns;
+
+  printf("%10.3f %14lu %12lu %14lu %12.0f %12.0f %14.0f %14.0f\n",
+         s->ns / 1e9, s->live_bytes, s->live_blocks, s->peak_bytes,
+         rate(n_allocs(&s->st), n_allocs(&prev->st), ns),
+         rate(s->st.n_free, prev->st.n_free, ns),
+         rate(s->st.n_allocb, prev->st.n_allocb, ns),
+         rate(s->st.n_freeb, prev->st.n_freeb, ns));
+}
+
+//
+// the live heap per size is the difference of the allocated and freed
+// blocks in each bucket
+//
+static void print_sizes(const shm_stats *s)
+{
+  const stats *st = &s->st;
+  unsigned long blocks, bytes;
+  int k;
+
+  for (k = 0; k < HIST_BUCKETS; k++) {
+    blocks = st->sz_alloc[k] - st->sz_free[k];
+    bytes = st->sz_allocb[k] - st->sz_freeb[k];
+    if (blocks == 0) continue;
+
+    printf("%10s %12lu .. %-12lu %12lu blocks %14lu bytes\n", "",
+           (unsigned long)hist_lower(k), (unsigned long)hist_upper(k),
+           blocks, bytes);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const shm_stats *shm;
+  shm_stats cur, prev;
+  struct timespec interval;
+  char path[64];
+  const char *file;
+  char *end;
+  long ms = 1000;
+  long count = -1;
+  bool sizes = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "i:n:s")) != -1) {
+    switch (c) {
+      case 'i': ms = strtol(optarg, NULL, 0); break;
+      case 'n': count = strtol(optarg, NULL, 0); break;
+      case 's': sizes = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if ((optind != argc - 1) || (ms <= 0)) usage(argv[0]);
+
+  file = argv[optind];
+  strtol(file, &end, 10);
+  if ((*file != '\0') && (*end == '\0')) {
+    snprintf(path, sizeof(path), "/dev/shm/memtrace.%s", file);
+    file = path;
+  }
+
+  if ((shm = shm_attach(file)) == NULL) {
+    fprintf(stderr, "%s: %s\n", file,
+            errno == EINVAL ? "not a memtrace statistics file" : strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  interval.tv_sec = ms / 1000;
+  interval.tv_nsec = (ms % 1000) * 1000000L;
+
+  if (shm_read(shm, &prev) != 0) memset(&prev, 0, sizeof(prev));
+  print_header(shm);
+
+  while (count != 0) {
+    nanosleep(&interval, NULL);
+
+    // the writer updates the page much less often than a reader could spin
+    // on it; a failed read is simply retried at the next update
+    if (shm_read(shm, &cur) != 0) continue;
+
+    print_line(&cur, &prev);
+    if (sizes) print_sizes(&cur);
+    fflush(stdout);
+
+    prev = cur;
+    if (cur.done) break;
+    if (count > 0) count--;
+  }
+
+  shm_unmap(shm);
+
+  return EXIT_SUCCESS;
+}
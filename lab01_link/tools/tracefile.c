@@ -0,0 +1,362 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memcodec.h"
+#include "tracefile.h"
+
+//
+// build the index of the chunks of a chunked file. A chunk cut short by
+// the end of the file (the traced process died while writing it) is ignored.
+//
+static int index_chunks(tracefile *t, const char *path)
+{
+  const char *p = t->base + sizeof(event_header), *end = t->base + t->len;
+  const event_chunk *h;
+  size_t cap = 0;
+  void *chunks;
+
+  while ((size_t)(end - p) >= sizeof(event_chunk)) {
+    h = (const event_chunk*)p;
+    if ((memcmp(h->magic, EVENT_CHUNK_MAGIC, sizeof(h->magic)) != 0) ||
+        (h->n > h->bytes)) {
+      fprintf(stderr, "%s: corrupt chunk at offset %zu, ignoring the rest\n",
+              path, (size_t)(p - t->base));
+      break;
+    }
+    if (h->bytes > (size_t)(end - p) - sizeof(event_chunk)) break;
+
+    if (t->nchunks == cap) {
+      cap = cap ? 2 * cap : 1024;
+      if ((chunks = realloc(t->chunks, cap * sizeof(event_chunk*))) == NULL) {
+        perror("realloc");
+        return -1;
+      }
+      t->chunks = chunks;
+    }
+    t->chunks[t->nchunks++] = h;
+
+    p += sizeof(event_chunk) + h->bytes;
+  }
+
+  return 0;
+}
+
+//
+// decode chunk k into a temporary buffer and find its first (or last)
+// calibration event
+//
+static void chunk_clock(tracefile *t, size_t k, int last, uint64_t *ticks,
+                        uint64_t *ns)
+{
+  const event_chunk *h = t->chunks[k];
+  event *ev;
+  long i;
+
+  if ((ev = malloc((h->n + 1) * sizeof(event))) == NULL) return;
+
+  if (codec_chunk(h, ev) == 0) {
+    for (i = last ? (long)h->n - 1 : 0; (i >= 0) && (i < (long)h->n);
+         i += last ? -1 : 1) {
+      if (ev[i].op == EV_CLOCK) {
+        *ticks = ev[i].tsc;
+        *ns = ev[i].ptr;
+        break;
+      }
+    }
+  }
+
+  free(ev);
+}
+
+int trace_open(tracefile *t, const char *path, size_t window, int threads)
+{
+  struct stat st;
+  const event *e;
+  size_t k;
+  int fd;
+
+  memset(t, 0, sizeof(tracefile));
+  t->last = -1;
+
+  if (((fd = open(path, O_RDONLY)) < 0) || (fstat(fd, &st) < 0)) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  if (st.st_size < (off_t)sizeof(event_header)) {
+    fprintf(stderr, "%s: not a memtrace event file\n", path);
+    close(fd);
+    return -1;
+  }
+
+  t->len = st.st_size;
+  t->base = mmap(NULL, t->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (t->base == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  madvise(t->base, t->len, MADV_SEQUENTIAL);
+
+  t->hdr = (const event_header*)t->base;
+  if ((memcmp(t->hdr->magic, EVENT_MAGIC, sizeof(t->hdr->magic)) != 0) ||
+      ((t->hdr->version != EVENT_VERSION) &&
+       (t->hdr->version != EVENT_VERSION_CHUNKED)) ||
+      (t->hdr->size != sizeof(event))) {
+    fprintf(stderr, "%s: not a memtrace event file (or wrong version)\n", path);
+    trace_close(t);
+    return -1;
+  }
+
+  // calibration: the writer starts and ends the file with EV_CLOCK events
+  if (t->hdr->version == EVENT_VERSION_CHUNKED) {
+    if (index_chunks(t, path) != 0) {
+      trace_close(t);
+      return -1;
+    }
+    if (t->nchunks > 0) {
+      chunk_clock(t, 0, 0, &t->ticks0, &t->ns0);
+      chunk_clock(t, t->nchunks - 1, 1, &t->ticks1, &t->ns1);
+    }
+
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    t->threads = threads < TRACE_THREADS ? threads : TRACE_THREADS;
+  } else {
+    t->pos = (const event*)(t->base + sizeof(event_header));
+    t->end = t->pos + (t->len - sizeof(event_header)) / sizeof(event);
+
+    for (e = t->pos; (e < t->end) && (e->op != EV_CLOCK); e++);
+    if (e < t->end) { t->ticks0 = e->tsc; t->ns0 = e->ptr; }
+    for (e = t->end; (e > t->pos) && (e[-1].op != EV_CLOCK); e--);
+    if (e > t->pos) { t->ticks1 = e[-1].tsc; t->ns1 = e[-1].ptr; }
+  }
+
+  t->window = window ? window : TRACE_WINDOW;
+  t->slots = malloc(t->window * sizeof(trace_slot));
+  t->free = malloc(t->window * sizeof(uint32_t));
+  t->heap = malloc(t->window * sizeof(uint32_t));
+  if ((t->slots == NULL) || (t->free == NULL) || (t->heap == NULL)) {
+    perror("malloc");
+    trace_close(t);
+    return -1;
+  }
+  for (k = 0; k < t->window; k++) t->free[k] = (uint32_t)(t->window - 1 - k);
+
+  return 0;
+}
+
+//
+// decode the next batch of chunks, one chunk per thread
+//
+typedef struct __job {
+  const event_chunk *h;
+  event *out;
+  pthread_t tid;
+  int started;
+  int res;
+} job;
+
+static void *decode_job(void *arg)
+{
+  job *j = arg;
+
+  j->res = codec_chunk(j->h, j->out);
+
+  return NULL;
+}
+
+static int decode_batch(tracefile *t)
+{
+  job jobs[TRACE_THREADS];
+  size_t n = 0, k, nj;
+  void *batch;
+
+  nj = t->nchunks - t->next;
+  if (nj > (size_t)t->threads) nj = t->threads;
+  if (nj == 0) return 0;
+
+  for (k = 0; k < nj; k++) n += t->chunks[t->next + k]->n;
+  if (n > t->bcap) {
+    if ((batch = realloc(t->batch, n * sizeof(event))) == NULL) {
+      perror("realloc");
+      return 0;
+    }
+    t->batch = batch;
+    t->bcap = n;
+  }
+
+  for (n = 0, k = 0; k < nj; k++) {
+    jobs[k].h = t->chunks[t->next + k];
+    jobs[k].out = t->batch + n;
+    jobs[k].started = 0;
+    n += jobs[k].h->n;
+  }
+
+  // the calling thread decodes the first chunk itself
+  for (k = 1; k < nj; k++) {
+    jobs[k].started = pthread_create(&jobs[k].tid, NULL, decode_job, &jobs[k]) == 0;
+    if (!jobs[k].started) decode_job(&jobs[k]);
+  }
+  decode_job(&jobs[0]);
+  for (k = 1; k < nj; k++) {
+    if (jobs[k].started) pthread_join(jobs[k].tid, NULL);
+  }
+
+  // stop at the first corrupt chunk
+  for (n = 0, k = 0; k < nj; k++) {
+    if (jobs[k].res != 0) {
+      fprintf(stderr, "corrupt chunk %zu, ignoring the rest of the trace\n",
+              t->next + k);
+      t->nchunks = t->next + k;
+      break;
+    }
+    n += jobs[k].h->n;
+  }
+  t->next += k;
+
+  t->nbatch = n;
+  t->bpos = 0;
+
+  return n > 0;
+}
+
+//
+// next event in file order
+//
+static const event *read_event(tracefile *t)
+{
+  const event *e;
+
+  do {
+    if (t->chunks == NULL) {
+      if (t->pos == t->end) return NULL;
+      e = t->pos++;
+    } else {
+      while (t->bpos == t->nbatch) {
+        if (!decode_batch(t)) return NULL;
+      }
+      e = &t->batch[t->bpos++];
+    }
+  } while (e->tsc < t->from);
+
+  return e;
+}
+
+void trace_seek(tracefile *t, uint64_t ns)
+{
+  const event *lo, *hi, *mid;
+  size_t k;
+  uint64_t tsc;
+
+  if ((t->ticks1 <= t->ticks0) || (t->ns1 <= t->ns0)) return;
+
+  // past the last calibration event nothing is left
+  if (ns > t->ns1 - t->ns0) tsc = UINT64_MAX;
+  else tsc = t->ticks0 + (uint64_t)((double)ns * (double)(t->ticks1 - t->ticks0) /
+                                    (double)(t->ns1 - t->ns0));
+  t->from = tsc;
+
+  if (t->chunks != NULL) {
+    // chunks overlap in time: first chunk with an event at or after tsc
+    for (k = 0; (k < t->nchunks) && (t->chunks[k]->tsc1 < tsc); k++);
+    t->next = k;
+    t->nbatch = t->bpos = 0;
+  } else {
+    // events are almost sorted: later events may precede the first one
+    // found by up to a reorder window; read_event() skips the earlier ones
+    for (lo = t->pos, hi = t->end; lo < hi; ) {
+      mid = lo + (hi - lo) / 2;
+      if (mid->tsc < tsc) lo = mid + 1;
+      else hi = mid;
+    }
+    t->pos = (size_t)(lo - t->pos) > t->window ? lo - t->window : t->pos;
+  }
+}
+
+static inline int before(const trace_slot *a, const trace_slot *b)
+{
+  // ties are broken by file order, which preserves per-thread order
+  return (a->e.tsc < b->e.tsc) || ((a->e.tsc == b->e.tsc) && (a->seq < b->seq));
+}
+
+static void push(tracefile *t, const event *e)
+{
+  uint32_t s = t->free[t->window - 1 - t->nheap];
+  size_t i = t->nheap++, p;
+
+  t->slots[s].e = *e;
+  t->slots[s].seq = t->seq++;
+
+  while (i > 0) {
+    p = (i - 1) / 2;
+    if (!before(&t->slots[s], &t->slots[t->heap[p]])) break;
+    t->heap[i] = t->heap[p];
+    i = p;
+  }
+  t->heap[i] = s;
+}
+
+static uint32_t pop(tracefile *t)
+{
+  uint32_t top = t->heap[0], last = t->heap[--t->nheap];
+  size_t i = 0, c;
+
+  while ((c = 2 * i + 1) < t->nheap) {
+    if ((c + 1 < t->nheap) &&
+        before(&t->slots[t->heap[c + 1]], &t->slots[t->heap[c]])) c++;
+    if (!before(&t->slots[t->heap[c]], &t->slots[last])) break;
+    t->heap[i] = t->heap[c];
+    i = c;
+  }
+  if (t->nheap > 0) t->heap[i] = last;
+
+  return top;
+}
+
+const event *trace_next(tracefile *t)
+{
+  const event *e;
+
+  // the slot of the previous event is free again
+  if (t->last >= 0) {
+    t->free[t->window - 1 - t->nheap] = (uint32_t)t->last;
+    t->last = -1;
+  }
+
+  while ((t->nheap < t->window) && ((e = read_event(t)) != NULL)) push(t, e);
+
+  if (t->nheap == 0) return NULL;
+
+  t->last = pop(t);
+
+  return &t->slots[t->last].e;
+}
+
+uint64_t trace_ns(tracefile *t, uint64_t tsc)
+{
+  double rate;
+
+  if ((t->ticks1 <= t->ticks0) || (t->ns1 <= t->ns0)) return 0;
+
+  rate = (double)(t->ns1 - t->ns0) / (double)(t->ticks1 - t->ticks0);
+  return (uint64_t)((double)(int64_t)(tsc - t->ticks0) * rate);
+}
+
+void trace_close(tracefile *t)
+{
+  if ((t->base != NULL) && (t->base != MAP_FAILED)) munmap(t->base, t->len);
+  free(t->chunks);
+  free(t->batch);
+  free(t->slots);
+  free(t->free);
+  free(t->heap);
+  memset(t, 0, sizeof(tracefile));
+}
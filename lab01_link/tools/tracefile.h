@@ -0,0 +1,123 @@
+#ifndef __TRACEFILE_H__
+#define __TRACEFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memevent.h"
+
+//
+// reader for event files written by memtrace (see memevent.h)
+//
+// The file is mapped into memory and read sequentially. Since the writer
+// drains the per-thread rings one after another, events of different threads
+// are slightly out of order in the file; trace_next() restores time order
+// with a min-heap over a sliding window of events.
+//
+// Chunked files are decoded a batch of chunks at a time, one chunk per
+// thread.
+//
+//   base       mapped file
+//   len        length of the file in bytes
+//   hdr        file header
+//   pos        next event to read from the file (plain files)
+//   end        end of the last complete event (plain files)
+//   chunks     index of the complete chunks (chunked files)
+//   nchunks    number of chunks
+//   next       next chunk to decode
+//   threads    number of chunks decoded in parallel
+//   batch      events of the chunks decoded last
+//   nbatch     number of events in the batch
+//   bpos       next event to read from the batch
+//   bcap       capacity of the batch
+//   slots      events in the reorder window
+//   free       unused slots, a stack of window - nheap slots while no
+//              event is returned
+//   heap       reorder window (min-heap of slots on tsc, then file order)
+//   nheap      number of events in the window
+//   window     capacity of the window
+//   last       slot of the event returned last (-1: none)
+//   seq        number of events read from the file
+//   from       time stamp before which events are skipped (trace_seek())
+//   ticks0,
+//   ns0        first calibration event
+//   ticks1,
+//   ns1        last calibration event
+//
+typedef struct __trace_slot {
+  event e;
+  uint64_t seq;
+} trace_slot;
+
+typedef struct __tracefile {
+  char *base;
+  size_t len;
+  const event_header *hdr;
+  const event *pos;
+  const event *end;
+  const event_chunk **chunks;
+  size_t nchunks;
+  size_t next;
+  int threads;
+  event *batch;
+  size_t nbatch;
+  size_t bpos;
+  size_t bcap;
+  trace_slot *slots;
+  uint32_t *free;
+  uint32_t *heap;
+  size_t nheap;
+  size_t window;
+  long last;
+  uint64_t seq;
+  uint64_t from;
+  uint64_t ticks0, ns0;
+  uint64_t ticks1, ns1;
+} tracefile;
+
+#define TRACE_WINDOW   65536
+#define TRACE_THREADS  64             // maximum number of decoding threads
+
+//
+// open a trace
+//
+//   t          trace to initialize
+//   path       name of the event file
+//   window     size of the reorder window in events (0: TRACE_WINDOW)
+//   threads    number of chunks of a chunked file decoded in parallel
+//              (0: one per online CPU)
+//
+// returns 0 on success, -1 on error (an error message has been printed)
+//
+int trace_open(tracefile *t, const char *path, size_t window, int threads);
+
+//
+// skip to the events recorded about ns nanoseconds after the first
+// calibration event. Must be called before the first trace_next(). Events
+// recorded before that time are not returned; a time past the end of the
+// trace leaves no events. A chunked file is read from the first chunk
+// holding a later event; a plain file from a reorder window before the
+// first later event, so events of other threads drained more than a window
+// late may be missed, as they would be reordered wrongly.
+//
+void trace_seek(tracefile *t, uint64_t ns);
+
+//
+// get the next event in time order
+//
+// returns a pointer to the event, valid until the next call, or NULL at the
+// end of the trace
+//
+const event *trace_next(tracefile *t);
+
+//
+// convert a time stamp to nanoseconds since the first calibration event
+//
+uint64_t trace_ns(tracefile *t, uint64_t tsc);
+
+//
+// close a trace
+//
+void trace_close(tracefile *t);
+
+#endif
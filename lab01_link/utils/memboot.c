@@ -0,0 +1,34 @@
+#include "memboot.h"
+
+//
+// the arena and the offset of its first free byte
+//
+char boot_arena[BOOT_ARENA_SIZE] __attribute__((aligned(4096)));
+static size_t top = 0;
+
+#define BOOT_ALIGN      16
+
+void *boot_alloc(size_t size, size_t align)
+{
+  size_t old, start, end;
+
+  if (align < BOOT_ALIGN) align = BOOT_ALIGN;
+
+  old = __atomic_load_n(&top, __ATOMIC_RELAXED);
+  do {
+    // leave room for the size in front of the block
+    start = (old + sizeof(size_t) + align - 1) & ~(align - 1);
+    end = start + size;
+    if ((end < start) || (end > BOOT_ARENA_SIZE)) return NULL;
+  } while (!__atomic_compare_exchange_n(&top, &old, end, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  *(size_t*)(boot_arena + start - sizeof(size_t)) = size;
+
+  return boot_arena + start;
+}
+
+size_t boot_size(void *ptr)
+{
+  return *((size_t*)ptr - 1);
+}
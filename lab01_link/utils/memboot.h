@@ -0,0 +1,47 @@
+#ifndef __MEMBOOT_H__
+#define __MEMBOOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// static bootstrap arena
+//
+// serves the allocations made before the real allocator functions are
+// known, e.g., by dlsym() while they are being resolved. Blocks are never
+// reused; freeing them is a no-op. Each block is preceded by its size.
+//
+#define BOOT_ARENA_SIZE   (64 * 1024)
+
+//
+// allocate a block from the arena
+//
+//   size       size of block
+//   align      alignment (power of two, at least 16; 0 for 16)
+//
+// returns
+//    void*     pointer to zero-initialized block or NULL if the arena is
+//              exhausted
+//
+// may be called concurrently
+//
+void *boot_alloc(size_t size, size_t align);
+
+//
+// size of an arena block
+//
+//   ptr        pointer returned by boot_alloc()
+//
+size_t boot_size(void *ptr);
+
+//
+// check whether ptr was allocated from the arena
+//
+extern char boot_arena[BOOT_ARENA_SIZE];
+
+static inline int boot_owns(void *ptr)
+{
+  return (uintptr_t)ptr - (uintptr_t)boot_arena < BOOT_ARENA_SIZE;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "memclock.h"
+
+//
+// calibration reference point and measured ticks per nanosecond
+//
+static uint64_t ticks0 = 0;
+static uint64_t ns0 = 0;
+static double rate = 0.0;
+
+void clock_init(void)
+{
+  ns0 = clock_mono_ns();
+  ticks0 = clock_ticks();
+}
+
+static double calibrate(void)
+{
+  uint64_t t, ns;
+
+  if (ns0 == 0) clock_init();
+
+  // need at least 10ms between the two reference points for a precise rate
+  do {
+    ns = clock_mono_ns();
+    t = clock_ticks();
+  } while (ns - ns0 < 10000000ULL);
+
+  return (double)(t - ticks0) / (double)(ns - ns0);
+}
+
+uint64_t clock_ns(uint64_t ticks)
+{
+  double r;
+
+  __atomic_load(&rate, &r, __ATOMIC_RELAXED);
+  if (r == 0.0) {
+    r = calibrate();
+    __atomic_store(&rate, &r, __ATOMIC_RELAXED);
+  }
+
+  return (uint64_t)(ticks / r);
+}
@@ -0,0 +1,57 @@
+#ifndef __MEMCLOCK_H__
+#define __MEMCLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//
+// read the time stamp counter (or a nanosecond clock where there is none)
+//
+// returns the current time in ticks. Ticks are only meaningful relative to
+// each other; use clock_ns() to convert a difference of ticks to nanoseconds.
+//
+static inline uint64_t clock_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+//
+// read the monotonic clock in nanoseconds
+//
+static inline uint64_t clock_mono_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+// remember a reference point for calibrating ticks against the monotonic
+// clock. Call once at startup.
+//
+void clock_init(void);
+
+//
+// convert a number of ticks to nanoseconds
+//
+//   ticks      number of ticks (e.g., a difference of two clock_ticks())
+//
+// the rate is measured between clock_init() and the first call to clock_ns()
+// that happens at least 10ms later; earlier calls use a short busy-wait
+// calibration.
+//
+uint64_t clock_ns(uint64_t ticks);
+
+#endif
@@ -0,0 +1,444 @@
+#include <string.h>
+
+#include "memcodec.h"
+
+//
+// fields encoded per op
+//
+//   F_PTR      ptr is a freed (or otherwise released) address
+//   F_PTRV     ptr is a plain value (alignment, calloc nmemb, mmap
+//              prot/flags, clock ns)
+//   F_SIZE     size
+//   F_RES      res is an allocated address
+//   F_RESV     res is a plain value (brk result)
+//
+#define F_PTR   0x01
+#define F_PTRV  0x02
+#define F_SIZE  0x04
+#define F_RES   0x08
+#define F_RESV  0x10
+
+#define TAG_FLAGS_SHIFT 4
+#define TAG_TID         0x40
+#define TAG_SAME_SIZE   0x80
+
+static const uint8_t fields[16] = {
+  [0]           = F_PTRV,                   // EV_CLOCK
+  [EV_MALLOC]   = F_SIZE | F_RES,
+  [EV_CALLOC]   = F_PTRV | F_SIZE | F_RES,
+  [EV_REALLOC]  = F_PTR | F_SIZE | F_RES,
+  [EV_FREE]     = F_PTR,
+  [EV_MEMALIGN] = F_PTRV | F_SIZE | F_RES,
+  [EV_NEW]      = F_PTRV | F_SIZE | F_RES,
+  [EV_DELETE]   = F_PTR,
+  [EV_MMAP]     = F_PTRV | F_SIZE | F_RES,
+  [EV_MUNMAP]   = F_PTR | F_SIZE,
+  [EV_MREMAP]   = F_PTR | F_SIZE | F_RES,
+  [EV_BRK]      = F_PTR | F_SIZE | F_RESV,
+  [EV_SBRK]     = F_SIZE | F_RES,
+};
+
+static inline int op_code(int op)
+{
+  return op == EV_CLOCK ? 0 : op;
+}
+
+static inline int code_op(int code)
+{
+  return code == 0 ? EV_CLOCK : code;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline size_t put_varint(uint8_t *buf, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    buf[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  buf[n++] = (uint8_t)v;
+
+  return n;
+}
+
+//
+// returns the number of bytes read or 0 if the input ends early
+//
+static inline size_t get_varint(const uint8_t *buf, size_t len, uint64_t *v)
+{
+  uint64_t r = 0;
+  size_t n = 0;
+  int shift = 0;
+
+  while ((n < len) && (shift < 64)) {
+    r |= (uint64_t)(buf[n] & 0x7f) << shift;
+    if ((buf[n++] & 0x80) == 0) {
+      *v = r;
+      return n;
+    }
+    shift += 7;
+  }
+
+  return 0;
+}
+
+//
+// a value with a selector bit, coded like a varint of v * 2 + bit but
+// without overflowing for large v
+//
+static inline size_t put_code(uint8_t *buf, uint64_t v, int bit)
+{
+  buf[0] = (uint8_t)(((v & 0x3f) << 1) | (bit & 1));
+  v >>= 6;
+  if (v == 0) return 1;
+
+  buf[0] |= 0x80;
+  return 1 + put_varint(buf + 1, v);
+}
+
+static inline size_t get_code(const uint8_t *buf, size_t len, uint64_t *v,
+                              int *bit)
+{
+  uint64_t hi;
+  size_t n;
+
+  if (len == 0) return 0;
+
+  *bit = buf[0] & 1;
+  *v = (buf[0] >> 1) & 0x3f;
+  if ((buf[0] & 0x80) == 0) return 1;
+
+  if ((n = get_varint(buf + 1, len - 1, &hi)) == 0) return 0;
+  *v |= hi << 6;
+
+  return 1 + n;
+}
+
+static inline size_t hash(uint64_t addr)
+{
+  return (size_t)((addr >> 4) * 0x9e3779b97f4a7c15ULL >> 32) & (CODEC_HASH - 1);
+}
+
+//
+// lists of recent addresses, most recent first
+//
+static inline void list_push(uint64_t *list, int n, uint64_t addr)
+{
+  memmove(&list[1], &list[0], (n - 1) * sizeof(uint64_t));
+  list[0] = addr;
+}
+
+static inline uint64_t list_take(uint64_t *list, int n, int k)
+{
+  uint64_t addr = list[k];
+
+  memmove(&list[k], &list[k + 1], (n - 1 - k) * sizeof(uint64_t));
+  list[n - 1] = 0;
+
+  return addr;
+}
+
+static inline int list_find(const uint64_t *list, int n, uint64_t addr)
+{
+  int k;
+
+  for (k = 0; (k < n) && (list[k] != addr); k++);
+
+  return k < n ? k : -1;
+}
+
+//
+// size bins of freed blocks: 16 byte steps up to 1 KiB, powers of 2 above
+//
+static inline uint64_t *size_bin(codec *c, uint64_t size)
+{
+  int b;
+
+  if (size <= 1024) return c->bin[(size + 15) >> 4];
+  for (b = 65; (size > 2048) && (b < CODEC_BINS - 1); b++) size >>= 1;
+
+  return c->bin[b];
+}
+
+//
+// allocation history
+//
+static void allocated(codec *c, uint64_t addr, uint64_t size, int index)
+{
+  if (addr == 0) return;
+
+  if (index) c->index[hash(addr)] = c->nalloc + 1;
+  c->hsize[c->nalloc & (CODEC_HIST - 1)] = size;
+  c->hist[c->nalloc++ & (CODEC_HIST - 1)] = addr;
+  c->alloc = addr + size;
+}
+
+//
+// freed addresses: by their position in the allocation history, or relative
+// to the end of the last allocation. Blocks found in the history are also
+// put into the bin of their size.
+//
+static size_t put_freed(codec *c, uint8_t *buf, uint64_t addr)
+{
+  uint64_t i = c->index[hash(addr)];
+  size_t n;
+
+  if (addr == 0) return put_code(buf, 0, 1);
+
+  if ((i > 0) && (i <= c->nalloc) && (c->nalloc - i < CODEC_HIST) &&
+      (c->hist[(i - 1) & (CODEC_HIST - 1)] == addr)) {
+    n = put_code(buf, c->nalloc - i + 1, 1);
+    list_push(size_bin(c, c->hsize[(i - 1) & (CODEC_HIST - 1)]),
+              CODEC_BIN_DEPTH, addr);
+  } else {
+    n = put_code(buf, zigzag((int64_t)(addr - c->alloc)), 0);
+  }
+  list_push(c->freed, CODEC_MRU, addr);
+
+  return n;
+}
+
+static size_t get_freed(codec *c, const uint8_t *buf, size_t len, uint64_t *addr)
+{
+  uint64_t v, i;
+  size_t n;
+  int bit;
+
+  if ((n = get_code(buf, len, &v, &bit)) == 0) return 0;
+
+  if (!bit) {
+    *addr = c->alloc + (uint64_t)unzigzag(v);
+  } else if (v == 0) {
+    *addr = 0;
+    return n;
+  } else {
+    if ((v > c->nalloc) || (v > CODEC_HIST)) return 0;
+    i = (c->nalloc - v) & (CODEC_HIST - 1);
+    *addr = c->hist[i];
+    list_push(size_bin(c, c->hsize[i]), CODEC_BIN_DEPTH, *addr);
+  }
+  list_push(c->freed, CODEC_MRU, *addr);
+
+  return n;
+}
+
+//
+// allocated addresses: a recently freed block of the same size bin or any
+// recently freed block (a block is reused), or relative to the end of the
+// last allocation (most allocators place consecutive new blocks next to
+// each other)
+//
+static size_t put_alloc(codec *c, uint8_t *buf, uint64_t addr, uint64_t size)
+{
+  uint64_t *bin = size_bin(c, size);
+  size_t n;
+  int k;
+
+  if (addr == 0) return put_code(buf, 0, 1);
+
+  if ((k = list_find(bin, CODEC_BIN_DEPTH, addr)) >= 0) {
+    n = put_code(buf, k + 1, 1);
+    list_take(bin, CODEC_BIN_DEPTH, k);
+  } else if ((k = list_find(c->freed, CODEC_MRU, addr)) >= 0) {
+    n = put_code(buf, CODEC_BIN_DEPTH + k + 1, 1);
+    list_take(c->freed, CODEC_MRU, k);
+  } else {
+    n = put_code(buf, zigzag((int64_t)(addr - c->alloc)), 0);
+  }
+  allocated(c, addr, size, 1);
+
+  return n;
+}
+
+static size_t get_alloc(codec *c, const uint8_t *buf, size_t len, uint64_t *addr,
+                        uint64_t size)
+{
+  uint64_t v;
+  size_t n;
+  int bit;
+
+  if ((n = get_code(buf, len, &v, &bit)) == 0) return 0;
+
+  if (!bit) {
+    *addr = c->alloc + (uint64_t)unzigzag(v);
+  } else if (v == 0) {
+    *addr = 0;
+  } else if (v <= CODEC_BIN_DEPTH) {
+    *addr = list_take(size_bin(c, size), CODEC_BIN_DEPTH, (int)v - 1);
+  } else if (v <= CODEC_BIN_DEPTH + CODEC_MRU) {
+    *addr = list_take(c->freed, CODEC_MRU, (int)(v - CODEC_BIN_DEPTH) - 1);
+  } else {
+    return 0;
+  }
+  allocated(c, *addr, size, 0);
+
+  return n;
+}
+
+//
+// make size the most recent size, dropping the oldest one (or size itself if
+// it was at position k)
+//
+static void sized(codec *c, int k, uint64_t size)
+{
+  if (k < 0) k = CODEC_SIZES - 1;
+  memmove(&c->sizes[1], &c->sizes[0], k * sizeof(uint64_t));
+  c->sizes[0] = size;
+}
+
+//
+// sizes other than the previous one: by their position among the recent
+// sizes, the difference to the previous size, or the size itself
+//
+static size_t put_size(codec *c, uint8_t *buf, uint64_t size)
+{
+  uint64_t d = zigzag((int64_t)(size - c->sizes[0])) + CODEC_SIZES;
+  size_t n;
+  int k;
+
+  for (k = 1; (k < CODEC_SIZES) && (c->sizes[k] != size); k++);
+  if (k < CODEC_SIZES) {
+    n = put_code(buf, k, 1);
+    sized(c, k, size);
+    return n;
+  }
+
+  // d wraps around for differences close to 2^63
+  if ((d >= CODEC_SIZES) && (d < size)) n = put_code(buf, d, 1);
+  else n = put_code(buf, size, 0);
+  sized(c, -1, size);
+
+  return n;
+}
+
+static size_t get_size(codec *c, const uint8_t *buf, size_t len, uint64_t *size)
+{
+  uint64_t v;
+  size_t n;
+  int bit;
+
+  if ((n = get_code(buf, len, &v, &bit)) == 0) return 0;
+
+  if (!bit) {
+    *size = v;
+    sized(c, -1, v);
+  } else if (v >= CODEC_SIZES) {
+    *size = c->sizes[0] + (uint64_t)unzigzag(v - CODEC_SIZES);
+    sized(c, -1, *size);
+  } else if (v > 0) {
+    *size = c->sizes[v];
+    sized(c, (int)v, *size);
+  } else {
+    return 0;
+  }
+
+  return n;
+}
+
+void codec_reset(codec *c, uint64_t tsc)
+{
+  // hist and index are only valid up to nalloc and need not be cleared
+  c->tsc = tsc >> CODEC_TSC_SHIFT;
+  c->tid = 0;
+  c->alloc = 0;
+  c->nalloc = 0;
+  memset(c->sizes, 0, sizeof(c->sizes));
+  memset(c->freed, 0, sizeof(c->freed));
+  memset(c->bin, 0, sizeof(c->bin));
+}
+
+size_t codec_put(codec *c, uint8_t *buf, const event *e)
+{
+  int code = op_code(e->op) & 0x0f;
+  uint8_t f = fields[code];
+  uint8_t tag = (uint8_t)code | (uint8_t)((e->flags & 0x03) << TAG_FLAGS_SHIFT);
+  size_t n = 1;
+
+  if (e->tid != c->tid) tag |= TAG_TID;
+  if ((f & F_SIZE) && (e->size == c->sizes[0])) tag |= TAG_SAME_SIZE;
+  buf[0] = tag;
+
+  if (tag & TAG_TID) n += put_varint(buf + n, e->tid);
+  n += put_varint(buf + n, zigzag((int64_t)((e->tsc >> CODEC_TSC_SHIFT) - c->tsc)));
+
+  if (f & F_PTR) n += put_freed(c, buf + n, e->ptr);
+  if (f & F_PTRV) n += put_varint(buf + n, e->ptr);
+  if ((f & F_SIZE) && !(tag & TAG_SAME_SIZE)) n += put_size(c, buf + n, e->size);
+  if (f & F_RES) n += put_alloc(c, buf + n, e->res, (f & F_SIZE) ? e->size : 0);
+  if (f & F_RESV) n += put_varint(buf + n, zigzag((int64_t)e->res));
+
+  c->tid = e->tid;
+  c->tsc = e->tsc >> CODEC_TSC_SHIFT;
+
+  return n;
+}
+
+size_t codec_get(codec *c, const uint8_t *buf, size_t len, event *e)
+{
+  uint64_t v;
+  uint8_t tag, f;
+  size_t n = 1, k;
+
+  if (len == 0) return 0;
+
+  tag = buf[0];
+  f = fields[tag & 0x0f];
+  memset(e, 0, sizeof(event));
+  e->op = (uint8_t)code_op(tag & 0x0f);
+  e->flags = (tag >> TAG_FLAGS_SHIFT) & 0x03;
+  e->tid = c->tid;
+  e->size = (f & F_SIZE) ? c->sizes[0] : 0;
+
+#define GET(call) { if ((k = (call)) == 0) return 0; n += k; }
+
+  if (tag & TAG_TID) {
+    GET(get_varint(buf + n, len - n, &v));
+    e->tid = (uint32_t)v;
+  }
+  GET(get_varint(buf + n, len - n, &v));
+  c->tsc += (uint64_t)unzigzag(v);
+  e->tsc = c->tsc << CODEC_TSC_SHIFT;
+
+  if (f & F_PTR) GET(get_freed(c, buf + n, len - n, &e->ptr));
+  if (f & F_PTRV) GET(get_varint(buf + n, len - n, &e->ptr));
+  if ((f & F_SIZE) && !(tag & TAG_SAME_SIZE)) GET(get_size(c, buf + n, len - n, &e->size));
+  if (f & F_RES) GET(get_alloc(c, buf + n, len - n, &e->res, e->size));
+  if (f & F_RESV) {
+    GET(get_varint(buf + n, len - n, &v));
+    e->res = (uint64_t)unzigzag(v);
+  }
+
+#undef GET
+
+  c->tid = e->tid;
+
+  return n;
+}
+
+int codec_chunk(const event_chunk *h, event *out)
+{
+  const uint8_t *p = (const uint8_t*)(h + 1);
+  size_t left = h->bytes, n;
+  uint32_t i;
+  codec c;
+
+  codec_reset(&c, h->tsc0);
+
+  for (i = 0; i < h->n; i++) {
+    if ((n = codec_get(&c, p, left, &out[i])) == 0) return -1;
+    p += n;
+    left -= n;
+  }
+
+  return left == 0 ? 0 : -1;
+}
@@ -0,0 +1,124 @@
+#ifndef __MEMCODEC_H__
+#define __MEMCODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memevent.h"
+
+//
+// compact encoding of events for chunked event files (EVENT_VERSION_CHUNKED,
+// see memevent.h)
+//
+// Each event is encoded as
+//
+//   tag        one byte: bits 0-3 op (EV_CLOCK as 0), bits 4-5 flags,
+//              bit 6 tid follows, bit 7 size equals the previous size
+//   tid        varint, only if it differs from the previous event's
+//   tsc        zigzag varint of the difference to the previous event's, in
+//              units of 2^CODEC_TSC_SHIFT ticks
+//   fields     the fields the op uses (see memcodec.c), in the order ptr,
+//              size, res
+//
+// Varints are LEB128. Sizes and addresses are coded as a value v and a
+// selector bit (like a varint of 2v + bit, see put_code()):
+//
+//   size       bit 1: the v-th most recent size if v < CODEC_SIZES,
+//              otherwise the zigzag difference to the previous size plus
+//              CODEC_SIZES; bit 0: the size
+//   freed      bit 1: NULL if v is 0, otherwise the result of the v-th most
+//   address    recent allocation (among the last CODEC_HIST); bit 0: zigzag
+//              difference to the end of the last allocation
+//   allocated  bit 1: NULL if v is 0, the v-th most recently freed block of
+//   address    the same size bin if v <= CODEC_BIN_DEPTH, otherwise the
+//              (v - CODEC_BIN_DEPTH)-th most recently freed address; bit 0:
+//              zigzag difference to the end of the last allocation
+//
+// The size of a freed block is known if it was allocated in the same chunk,
+// so allocators that hand out the block of the same size freed last (as the
+// caches of glibc do) are coded in a byte.
+//
+// Time stamps are the only lossy field: the low CODEC_TSC_SHIFT bits are
+// dropped (a few ns, below the cost of tracing a call), which saves about a
+// byte per event. The coder state is reset at the beginning of every chunk,
+// so chunks can be decoded independently of each other.
+//
+#define CODEC_TSC_SHIFT 6             // time stamp resolution (log2 ticks)
+#define CODEC_SIZES     16            // recent sizes
+#define CODEC_MRU       8             // recently freed addresses
+#define CODEC_BINS      128           // size bins of freed blocks
+#define CODEC_BIN_DEPTH 4             // recently freed addresses per bin
+#define CODEC_HIST      4096          // recent allocations, power of 2
+#define CODEC_HASH      8192          // power of 2
+#define CODEC_MAX_EVENT 64            // upper bound of an encoded event
+
+//
+// coder state
+//
+//   tsc        time stamp of the previous event (>> CODEC_TSC_SHIFT)
+//   tid        thread of the previous event
+//   sizes      most recent sizes, most recent first
+//   alloc      end of the last allocation (address + size)
+//   nalloc     number of allocations in the chunk
+//   freed      most recently freed addresses, most recent first
+//   bin        most recently freed addresses by size bin
+//   hist,
+//   hsize      results and sizes of the last CODEC_HIST allocations,
+//              allocation i at i % CODEC_HIST
+//   index      allocation + 1 by address hash (encoder only; entries are
+//              verified against hist and need not be reset)
+//
+typedef struct __codec {
+  uint64_t tsc;
+  uint32_t tid;
+  uint64_t sizes[CODEC_SIZES];
+  uint64_t alloc;
+  uint64_t nalloc;
+  uint64_t freed[CODEC_MRU];
+  uint64_t bin[CODEC_BINS][CODEC_BIN_DEPTH];
+  uint64_t hist[CODEC_HIST];
+  uint64_t hsize[CODEC_HIST];
+  uint64_t index[CODEC_HASH];
+} codec;
+
+//
+// reset the state at the beginning of a chunk
+//
+//   c          coder state
+//   tsc        time stamp of the chunk (event_chunk.tsc0)
+//
+void codec_reset(codec *c, uint64_t tsc);
+
+//
+// encode an event
+//
+//   c          coder state
+//   buf        output, at least CODEC_MAX_EVENT bytes
+//   e          event
+//
+// returns the number of bytes written
+//
+size_t codec_put(codec *c, uint8_t *buf, const event *e);
+
+//
+// decode an event
+//
+//   c          coder state
+//   buf, len   input
+//   e          event to fill in
+//
+// returns the number of bytes read or 0 if the input is truncated or corrupt
+//
+size_t codec_get(codec *c, const uint8_t *buf, size_t len, event *e);
+
+//
+// decode a whole chunk
+//
+//   h          chunk header, followed by h->bytes bytes of events
+//   out        h->n events
+//
+// returns 0 on success, -1 if the chunk is corrupt
+//
+int codec_chunk(const event_chunk *h, event *out);
+
+#endif
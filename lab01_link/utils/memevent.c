@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memclock.h"
+#include "memcodec.h"
+#include "memevent.h"
+#include "mempool.h"
+
+//
+// single-producer single-consumer ring of events
+//
+//   head       next slot to write, only advanced by the owning thread
+//   tail       next slot to read, only advanced by the writer thread
+//   ev         events; head and tail grow without bound and are taken modulo
+//              RING_SIZE
+//
+// head and tail live on separate cache lines so that producer and consumer
+// do not contend.
+//
+#define RING_SIZE       4096
+
+typedef struct __ring {
+  unsigned long head;
+  char pad0[64 - sizeof(unsigned long)];
+  unsigned long tail;
+  char pad1[64 - sizeof(unsigned long)];
+  event ev[RING_SIZE];
+} ring;
+
+//
+// output file and write buffer (only used by the draining thread)
+//
+// plain files buffer up to WBUF_EVENTS events. Chunked files encode the
+// events into the chunk buffer and write a chunk when it is full or a
+// calibration event is written.
+//
+#define WBUF_EVENTS     1024
+#define CHUNK_BYTES     (64 * 1024)
+
+static int fd = -1;
+static event wbuf[WBUF_EVENTS];
+static size_t wlen = 0;
+static unsigned long dropped = 0;
+
+static int chunked = 0;
+static struct {
+  event_chunk h;
+  uint8_t data[CHUNK_BYTES];
+} chunk;
+static codec coder;
+
+static void write_all(const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    p += n; len -= n;
+  }
+}
+
+static void flush(void)
+{
+  if (chunked) {
+    if (chunk.h.n == 0) return;
+    write_all(&chunk, sizeof(event_chunk) + chunk.h.bytes);
+    chunk.h.n = 0;
+    chunk.h.bytes = 0;
+    return;
+  }
+
+  write_all(wbuf, wlen * sizeof(event));
+  wlen = 0;
+}
+
+static void emit(event *e)
+{
+  if (chunked) {
+    if (chunk.h.n == 0) {
+      chunk.h.tsc0 = e->tsc;
+      chunk.h.tsc1 = e->tsc;
+      codec_reset(&coder, e->tsc);
+    }
+    if (e->tsc > chunk.h.tsc1) chunk.h.tsc1 = e->tsc;
+    chunk.h.bytes += codec_put(&coder, chunk.data + chunk.h.bytes, e);
+    chunk.h.n++;
+    if (chunk.h.bytes > CHUNK_BYTES - CODEC_MAX_EVENT) flush();
+    return;
+  }
+
+  wbuf[wlen++] = *e;
+  if (wlen == WBUF_EVENTS) flush();
+}
+
+int event_open(const char *path, int chunk_events)
+{
+  event_header h;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return -1;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, EVENT_MAGIC, sizeof(h.magic));
+  h.version = chunk_events ? EVENT_VERSION_CHUNKED : EVENT_VERSION;
+  h.size = sizeof(event);
+  h.pid = (uint32_t)getpid();
+
+  if (write(fd, &h, sizeof(h)) != sizeof(h)) {
+    close(fd);
+    fd = -1;
+    return -1;
+  }
+
+  chunked = chunk_events;
+  memset(&chunk.h, 0, sizeof(event_chunk));
+  memcpy(chunk.h.magic, EVENT_CHUNK_MAGIC, sizeof(chunk.h.magic));
+
+  event_clock();
+
+  return 0;
+}
+
+void event_detach(void)
+{
+  __atomic_store_n(&fd, -1, __ATOMIC_RELEASE);
+}
+
+//
+// create the ring of a shard. Rings are obtained with meta_map so that
+// creating one does not re-enter malloc.
+//
+static ring *new_ring(shard *s)
+{
+  ring *r;
+
+  r = meta_map(sizeof(ring));
+  if (r == NULL) return NULL;
+
+  __atomic_store_n(&s->ring, r, __ATOMIC_RELEASE);
+
+  return r;
+}
+
+void event_put(shard *s, int op, int flags, void *ptr, size_t size,
+               void *res, uint64_t tsc)
+{
+  ring *r = s->ring;
+  unsigned long head;
+  event *e;
+
+  if (__atomic_load_n(&fd, __ATOMIC_ACQUIRE) < 0) {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if ((r == NULL) && ((r = new_ring(s)) == NULL)) {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // wait for the writer thread if the ring is full
+  head = r->head;
+  while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+    if (__atomic_load_n(&fd, __ATOMIC_ACQUIRE) < 0) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    sched_yield();
+  }
+
+  e = &r->ev[head & (RING_SIZE - 1)];
+  e->op = (uint8_t)op;
+  e->flags = (uint8_t)flags;
+  e->reserved = 0;
+  e->tid = (uint32_t)s->tid;
+  e->tsc = tsc;
+  e->ptr = (uint64_t)(uintptr_t)ptr;
+  e->size = (uint64_t)size;
+  e->res = (uint64_t)(uintptr_t)res;
+
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t event_drain(void)
+{
+  unsigned long head, tail;
+  size_t n = 0;
+  shard *s;
+  ring *r;
+
+  if (fd < 0) return 0;
+
+  for (s = shard_first(); s != NULL; s = s->next) {
+    r = __atomic_load_n(&s->ring, __ATOMIC_ACQUIRE);
+    if (r == NULL) continue;
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    for (tail = r->tail; tail != head; tail++) {
+      emit(&r->ev[tail & (RING_SIZE - 1)]);
+      n++;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  // chunks are only written when full (or at calibration events)
+  if (wlen > 0) flush();
+
+  return n;
+}
+
+void event_clock(void)
+{
+  event e;
+
+  if (fd < 0) return;
+
+  memset(&e, 0, sizeof(e));
+  e.op = EV_CLOCK;
+  e.ptr = clock_mono_ns();
+  e.tsc = clock_ticks();
+
+  emit(&e);
+  if (chunked) flush();
+}
+
+void event_close(void)
+{
+  if (fd < 0) return;
+
+  event_drain();
+  event_clock();
+  flush();
+
+  close(fd);
+  fd = -1;
+}
+
+unsigned long event_dropped(void)
+{
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
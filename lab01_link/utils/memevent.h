@@ -0,0 +1,194 @@
+#ifndef __MEMEVENT_H__
+#define __MEMEVENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memshard.h"
+
+//
+// binary allocation event log
+//
+// Every traced call is recorded as a fixed-size event in a ring buffer of
+// the calling thread (see shard->ring). A background thread drains the
+// rings with event_drain() and appends the events to a file:
+//
+//   event_header   once at the beginning of the file
+//   event          any number of events in the order they were drained
+//
+// Events of one thread appear in the order they happened; events of
+// different threads may be interleaved out of order (sort by tsc).
+//
+// In a chunked file (header version EVENT_VERSION_CHUNKED) the header is
+// followed by chunks instead:
+//
+//   event_chunk    chunk header
+//   bytes          the chunk's events, encoded compactly (see memcodec.h)
+//
+// Each chunk can be decoded on its own; a reader can skip from chunk to
+// chunk by their sizes without decoding them, e.g., to seek to a time stamp
+// or to decode several chunks in parallel. Since the rings are drained one
+// after another, the time stamps of consecutive chunks overlap; a reader
+// seeking to a time stamp starts at the first chunk whose tsc1 is not before
+// it.
+//
+
+#define EVENT_MAGIC     "MEMTRACE"
+#define EVENT_VERSION   1
+#define EVENT_VERSION_CHUNKED 4
+
+//
+// event types
+//
+#define EV_MALLOC       1
+#define EV_CALLOC       2
+#define EV_REALLOC      3
+#define EV_FREE         4
+#define EV_MEMALIGN     5         // posix_memalign, aligned_alloc, memalign, valloc, pvalloc
+#define EV_NEW          6         // C++ operator new, new[] (all versions)
+#define EV_DELETE       7         // C++ operator delete, delete[] (all versions)
+#define EV_MMAP         8         // mmap, mmap64
+#define EV_MUNMAP       9
+#define EV_MREMAP       10
+#define EV_BRK          11
+#define EV_SBRK         12
+#define EV_CLOCK        16        // calibration: tsc and ptr = CLOCK_MONOTONIC ns
+
+//
+// event flags
+//
+#define EVF_DOUBLE_FREE   0x01    // ptr was freed before (call ignored)
+#define EVF_ILLEGAL_FREE  0x02    // ptr was never allocated (call ignored)
+
+//
+// file header
+//
+//   magic      EVENT_MAGIC (not NUL-terminated)
+//   version    EVENT_VERSION
+//   size       sizeof(event)
+//   pid        id of the traced process
+//
+typedef struct __event_header {
+  char magic[8];
+  uint32_t version;
+  uint16_t size;
+  uint16_t reserved;
+  uint32_t pid;
+  uint32_t reserved2;
+} event_header;
+
+//
+// event record
+//
+//   op         event type (EV_*)
+//   flags      event flags (EVF_*)
+//   tid        kernel thread id of the calling thread
+//   tsc        time stamp counter (see memclock.h)
+//   ptr        pointer argument (realloc, free, delete), requested
+//              alignment (memalign, new; 0 for unaligned new) or nmemb
+//              (calloc; 0 in files written before it was recorded)
+//   size       requested size (nmemb * size for calloc)
+//   res        returned pointer (malloc, calloc, realloc, memalign, new)
+//
+// for the OS-level calls
+//
+//   mmap       ptr = prot | flags << 8, size = length, res = mapped address
+//   munmap     ptr = address, size = length
+//   mremap     ptr = old address, size = new length, res = new address
+//   brk        ptr = requested break, size = bytes added to the heap (two's
+//              complement), res = return value (0 or -1)
+//   sbrk       size = increment (two's complement), res = previous break
+//
+typedef struct __event {
+  uint8_t op;
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t tid;
+  uint64_t tsc;
+  uint64_t ptr;
+  uint64_t size;
+  uint64_t res;
+} event;
+
+//
+// chunk header (chunked files)
+//
+//   magic      EVENT_CHUNK_MAGIC (not NUL-terminated)
+//   bytes      size of the encoded events following the header
+//   n          number of events in the chunk
+//   tsc0       time stamp of the first event of the chunk
+//   tsc1       largest time stamp of the events in the chunk
+//
+#define EVENT_CHUNK_MAGIC "CHNK"
+
+typedef struct __event_chunk {
+  char magic[4];
+  uint32_t bytes;
+  uint32_t n;
+  uint32_t reserved;
+  uint64_t tsc0;
+  uint64_t tsc1;
+} event_chunk;
+
+
+//
+// open the event file and write the header
+//
+//   path       name of the file to create
+//   chunked    write compactly encoded chunks instead of plain events
+//
+// returns 0 on success, -1 on error
+//
+int event_open(const char *path, int chunked);
+
+//
+// stop recording in this process without touching the file, e.g., in the
+// child after fork() where no thread drains the rings. Later events are
+// dropped.
+//
+void event_detach(void);
+
+//
+// append an event to the ring buffer of the calling thread
+//
+//   s          shard of the calling thread
+//   op         event type (EV_*)
+//   flags      event flags (EVF_*)
+//   ptr, size,
+//   res        see event
+//   tsc        time stamp of the call
+//
+// lock-free; if the ring is full the caller waits until the writer thread
+// has made room.
+//
+void event_put(shard *s, int op, int flags, void *ptr, size_t size,
+               void *res, uint64_t tsc);
+
+//
+// write the events of all rings to the file. Must only be called by one
+// thread at a time (the writer thread, and event_close() once it stopped).
+//
+// returns the number of events written
+//
+size_t event_drain(void);
+
+//
+// write a calibration event relating the time stamp counter to the
+// monotonic clock. In a chunked file the current chunk is completed after
+// the event, so a file is readable up to its last calibration event even if
+// the process dies.
+//
+void event_clock(void);
+
+//
+// drain all rings, write a final calibration event and close the file
+//
+void event_close(void);
+
+//
+// number of events lost because no writer was draining the rings or a ring
+// could not be created
+//
+unsigned long event_dropped(void);
+
+#endif
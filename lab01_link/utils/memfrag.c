@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memfrag.h"
+#include "memshard.h"
+
+//
+// pages are collected in an array and indexed by page number in an
+// open-addressing hash table of index + 1 (0 is empty), grown at half load
+//
+typedef struct {
+  frag_page *pages;
+  size_t n, cap;
+  uint32_t *index;
+  size_t slots;
+} page_set;
+
+static inline size_t page_hash(uintptr_t addr, size_t slots)
+{
+  return ((addr / FRAG_PAGE) * 0x9e3779b97f4a7c15ULL >> 16) & (slots - 1);
+}
+
+static int page_grow(page_set *ps)
+{
+  size_t slots = ps->slots ? 2 * ps->slots : 4096, k, h;
+  uint32_t *index = calloc(slots, sizeof(uint32_t));
+
+  if (index == NULL) return -1;
+
+  for (k = 0; k < ps->n; k++) {
+    h = page_hash(ps->pages[k].addr, slots);
+    while (index[h] != 0) h = (h + 1) & (slots - 1);
+    index[h] = (uint32_t)(k + 1);
+  }
+
+  free(ps->index);
+  ps->index = index;
+  ps->slots = slots;
+
+  return 0;
+}
+
+static frag_page *page_get(page_set *ps, uintptr_t addr)
+{
+  frag_page *p;
+  size_t h;
+
+  if ((2 * (ps->n + 1) > ps->slots) && (page_grow(ps) != 0)) return NULL;
+
+  h = page_hash(addr, ps->slots);
+  while (ps->index[h] != 0) {
+    p = &ps->pages[ps->index[h] - 1];
+    if (p->addr == addr) return p;
+    h = (h + 1) & (ps->slots - 1);
+  }
+
+  if (ps->n == ps->cap) {
+    size_t cap = ps->cap ? 2 * ps->cap : 1024;
+    frag_page *pages = realloc(ps->pages, cap * sizeof(frag_page));
+
+    if (pages == NULL) return NULL;
+    ps->pages = pages;
+    ps->cap = cap;
+  }
+
+  p = &ps->pages[ps->n++];
+  p->addr = addr;
+  p->bytes = 0;
+  p->blocks = 0;
+  p->pin = NULL;
+  ps->index[h] = (uint32_t)ps->n;
+
+  return p;
+}
+
+static int by_addr(const void *a, const void *b)
+{
+  const frag_page *x = a, *y = b;
+
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+//
+// account a live block to the pages it overlaps
+//
+static int add_block(page_set *ps, item *i)
+{
+  uintptr_t start = (uintptr_t)i->ptr, end = start + i->size, a, lo, hi;
+  frag_page *p;
+
+  for (a = start & ~(uintptr_t)(FRAG_PAGE - 1); a < end; a += FRAG_PAGE) {
+    if ((p = page_get(ps, a)) == NULL) return -1;
+
+    lo = start > a ? start : a;
+    hi = end < a + FRAG_PAGE ? end : a + FRAG_PAGE;
+    p->bytes += (uint32_t)(hi - lo);
+    p->blocks++;
+    p->pin = i;
+  }
+
+  return 0;
+}
+
+frag *frag_scan(void)
+{
+  page_set ps = { NULL, 0, 0, NULL, 0 };
+  frag *f;
+  frag_page *p;
+  shard *sh;
+  item *i;
+  site *s;
+  size_t k;
+  int b;
+
+  f = calloc(1, sizeof(frag));
+  if ((f == NULL) || ((f->pins = new_sites()) == NULL)) {
+    free(f);
+    return NULL;
+  }
+
+  for (sh = shard_first(); sh != NULL; sh = sh->next) {
+    for (i = sh->list->next; i != NULL; i = __atomic_load_n(&i->next, __ATOMIC_ACQUIRE)) {
+      if (__atomic_load_n(&i->cnt, __ATOMIC_ACQUIRE) <= 0) continue;
+      if ((i->ptr == NULL) || (i->size == 0)) continue;
+
+      if (add_block(&ps, i) != 0) {
+        free(ps.pages);
+        free(ps.index);
+        frag_free(f);
+        return NULL;
+      }
+    }
+  }
+  free(ps.index);
+
+  qsort(ps.pages, ps.n, sizeof(frag_page), by_addr);
+  f->pages = ps.pages;
+  f->n = ps.n;
+
+  for (k = 0; k < f->n; k++) {
+    p = &f->pages[k];
+
+    // blocks resized during the walk may overfill a page
+    if (p->bytes > FRAG_PAGE) p->bytes = FRAG_PAGE;
+
+    f->live_bytes += p->bytes;
+    b = (int)((p->bytes * FRAG_BUCKETS - 1) / FRAG_PAGE);
+    f->hist[b]++;
+
+    if ((p->blocks == 1) && (p->pin->size < FRAG_PAGE) &&
+        (p->bytes * 100 < FRAG_PINNED * FRAG_PAGE)) {
+      f->n_pinned++;
+      f->pinned_free += FRAG_PAGE - p->bytes;
+
+      s = p->pin->site ? get_site(f->pins, p->pin->site->pc, p->pin->site->depth)
+                       : get_site(f->pins, NULL, 0);
+      site_alloc(s, 1, FRAG_PAGE - p->bytes);
+    }
+  }
+
+  return f;
+}
+
+int frag_write(const frag *f, const char *path, uint64_t ns)
+{
+  static const char heat[] = "0123456789abcdef";
+  FILE *out;
+  size_t k, e, n;
+  uintptr_t a;
+
+  if ((out = fopen(path, "we")) == NULL) return -1;
+
+  fprintf(out, "memtrace heatmap %d\n", FRAG_VERSION);
+  fprintf(out, "pid %d\n", (int)getpid());
+  fprintf(out, "time_ns %lu\n", (unsigned long)ns);
+  fprintf(out, "page_size %d\n", FRAG_PAGE);
+  fprintf(out, "pages %zu\n", f->n);
+  fprintf(out, "live_bytes %lu\n", f->live_bytes);
+
+  for (k = 0; k < f->n; k = e) {
+    // pages k..e-1 form a run
+    for (e = k + 1; e < f->n; e++) {
+      if (f->pages[e].addr - f->pages[e - 1].addr > (FRAG_GAP + 1) * FRAG_PAGE) break;
+    }
+
+    n = (f->pages[e - 1].addr - f->pages[k].addr) / FRAG_PAGE + 1;
+    fprintf(out, "run %lx %zu ", (unsigned long)f->pages[k].addr, n);
+    for (a = f->pages[k].addr; k < e; a += FRAG_PAGE) {
+      if (f->pages[k].addr == a) {
+        fputc(heat[f->pages[k].bytes * 16 / (FRAG_PAGE + 1)], out);
+        k++;
+      } else {
+        fputc('.', out);
+      }
+    }
+    fputc('\n', out);
+  }
+
+  return fclose(out) == 0 ? 0 : -1;
+}
+
+void frag_free(frag *f)
+{
+  if (f == NULL) return;
+
+  free(f->pages);
+  if (f->pins != NULL) free_sites(f->pins);
+  free(f);
+}
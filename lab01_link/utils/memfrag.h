@@ -0,0 +1,109 @@
+#ifndef __MEMFRAG_H__
+#define __MEMFRAG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memlist.h"
+#include "memsite.h"
+
+//
+// page occupancy of the live blocks
+//
+// The live blocks of all shards are accounted to the FRAG_PAGE-sized pages
+// they overlap. A page holding live bytes is touched: the allocator cannot
+// return it to the OS, however few of its bytes are live. A page is pinned if
+// a single live block smaller than a page keeps it while less than
+// FRAG_PINNED percent of it is in use; freeing or moving that block would
+// let the page go.
+//
+// Heatmap files are text:
+//
+//   memtrace heatmap 1
+//   pid <pid>
+//   time_ns <ns since the start of the process>
+//   page_size <FRAG_PAGE>
+//   pages <touched pages>
+//   live_bytes <bytes>
+//   run <address of the first page> <n> <n characters>
+//   ...
+//
+// A run covers n consecutive pages with one character per page: the live
+// bytes of the page in sixteenths ('0' to 'f', '0' meaning less than a
+// sixteenth but not empty), or '.' for a page without live blocks. Runs are
+// split at gaps of more than FRAG_GAP empty pages.
+//
+#define FRAG_VERSION    1
+#define FRAG_PAGE       4096
+#define FRAG_PINNED     25            // percent of a page
+#define FRAG_GAP        16            // empty pages within a run
+#define FRAG_BUCKETS    10            // occupancy histogram (deciles)
+
+//
+// a touched page
+//
+//   addr       address of the page
+//   bytes      live bytes in the page
+//   blocks     number of live blocks overlapping the page
+//   pin        one of these blocks (the only one if blocks is 1)
+//
+typedef struct __frag_page {
+  uintptr_t addr;
+  uint32_t bytes;
+  uint32_t blocks;
+  item *pin;
+} frag_page;
+
+//
+// occupancy of the touched pages
+//
+//   pages      touched pages in order of address
+//   n          number of touched pages
+//   live_bytes live bytes in these pages
+//   hist       number of pages per occupancy decile: bucket k holds the
+//              pages with more than k * 10% and at most (k + 1) * 10% in use
+//   n_pinned   number of pinned pages
+//   pinned_free  unused bytes of the pinned pages
+//   pins       pinned pages per call site of the pinning block: n_alloc
+//              pages, n_allocb unused bytes. Blocks without a call site go to
+//              a site without frames.
+//
+typedef struct __frag {
+  frag_page *pages;
+  size_t n;
+  unsigned long live_bytes;
+  unsigned long hist[FRAG_BUCKETS];
+  unsigned long n_pinned;
+  unsigned long pinned_free;
+  site *pins;
+} frag;
+
+//
+// compute the page occupancy of the live blocks of all shards
+//
+// returns
+//    frag*     occupancy (free with frag_free()) or NULL on error
+//
+// may be called while other threads allocate and free blocks: the block
+// tables are only read. Blocks allocated or freed during the walk may or may
+// not be included. The caller must not be traced (the function allocates).
+//
+frag *frag_scan(void);
+
+//
+// write a heatmap of the touched pages
+//
+//   f          occupancy
+//   path       file name
+//   ns         time since the start of the process in nanoseconds
+//
+// returns 0 on success, -1 on error
+//
+int frag_write(const frag *f, const char *path, uint64_t ns);
+
+//
+// free an occupancy computed by frag_scan()
+//
+void frag_free(frag *f);
+
+#endif
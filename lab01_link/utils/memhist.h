@@ -0,0 +1,35 @@
+#ifndef __MEMHIST_H__
+#define __MEMHIST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// log2 histogram buckets
+//
+// bucket 0 holds the value 0, bucket k > 0 holds values in [2^(k-1), 2^k).
+//
+#define HIST_BUCKETS    65
+
+static inline int hist_bucket(uint64_t v)
+{
+  return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+//
+// smallest value in bucket k
+//
+static inline uint64_t hist_lower(int k)
+{
+  return k ? 1ULL << (k - 1) : 0;
+}
+
+//
+// largest value in bucket k
+//
+static inline uint64_t hist_upper(int k)
+{
+  return k ? (k < 64 ? (1ULL << k) - 1 : UINT64_MAX) : 0;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "memlat.h"
+
+//
+// recompute the threshold for entering the list of slowest calls
+//
+static void update_min(latency *l)
+{
+  int k;
+
+  l->min_slow = l->slow[0].ticks;
+  for (k = 1; k < l->n_slow; k++) {
+    if (l->slow[k].ticks < l->min_slow) l->min_slow = l->slow[k].ticks;
+  }
+}
+
+void lat_slow(latency *l, int op, size_t size, uint64_t ticks,
+              struct __site *site)
+{
+  slow_call *c;
+  int k;
+
+  if (l->n_slow < LAT_SLOWEST) {
+    c = &l->slow[l->n_slow++];
+  } else {
+    if (ticks <= l->min_slow) return;
+    for (k = 0; l->slow[k].ticks != l->min_slow; k++);
+    c = &l->slow[k];
+  }
+
+  c->ticks = ticks;
+  c->op = op;
+  c->size = size;
+  c->site = site;
+
+  if (l->n_slow == LAT_SLOWEST) update_min(l);
+}
+
+void lat_merge(latency *total, latency *l)
+{
+  int o, c, k, n;
+
+  for (o = 0; o < LAT_OPS; o++) {
+    for (c = 0; c < LAT_CLASSES; c++) {
+      for (k = 0; k < LAT_BUCKETS; k++) {
+        total->hist[o][c][k] += __atomic_load_n(&l->hist[o][c][k], __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  n = __atomic_load_n(&l->n_slow, __ATOMIC_RELAXED);
+  for (k = 0; k < n; k++) {
+    lat_slow(total, l->slow[k].op, l->slow[k].size, l->slow[k].ticks,
+             l->slow[k].site);
+  }
+}
+
+uint64_t lat_percentile(const unsigned long *hist, double q)
+{
+  unsigned long n = 0, sum = 0, rank;
+  int k;
+
+  for (k = 0; k < LAT_BUCKETS; k++) n += hist[k];
+  if (n == 0) return 0;
+
+  // the rank-th smallest latency, counting from 1
+  rank = (unsigned long)(q * n);
+  if (rank < q * n) rank++;
+  if (rank == 0) rank = 1;
+
+  for (k = 0; k < LAT_BUCKETS - 1; k++) {
+    sum += hist[k];
+    if (sum >= rank) break;
+  }
+
+  return k < LAT_BUCKETS - 1 ? lat_lower(k + 1) - 1 : UINT64_MAX;
+}
@@ -0,0 +1,150 @@
+#ifndef __MEMLAT_H__
+#define __MEMLAT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// latency of the calls to the allocator
+//
+// latencies are measured in ticks (see memclock.h) and counted per call
+// type, size class and log-linear latency bucket: every power of two is
+// split into LAT_SUB buckets, so a percentile read from the histogram is
+// at most 25% above the true value.
+//
+#define LAT_OPS         8             // call types, indexed by EV_* (memevent.h)
+#define LAT_CLASSES     6             // size classes, see lat_class()
+#define LAT_SUB_BITS    2
+#define LAT_SUB         (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS     128           // up to 2^33 ticks; slower calls go to the last bucket
+#define LAT_SLOWEST     16            // number of slowest calls kept
+
+//
+// one of the slowest calls
+//
+//   ticks      latency
+//   op         call type (EV_*)
+//   size       requested size (size of the freed block for free/delete)
+//   site       call site that allocated the block or NULL
+//
+typedef struct __slow_call {
+  uint64_t ticks;
+  int op;
+  size_t size;
+  struct __site *site;
+} slow_call;
+
+//
+// latency statistics of one thread
+//
+//   hist       number of calls per call type, size class and latency bucket
+//   slow       the slowest calls, in no particular order
+//   n_slow     number of valid entries in slow
+//   min_slow   latency of the fastest call in slow once slow is full
+//
+typedef struct __latency {
+  unsigned long hist[LAT_OPS][LAT_CLASSES][LAT_BUCKETS];
+  slow_call slow[LAT_SLOWEST];
+  int n_slow;
+  uint64_t min_slow;
+} latency;
+
+//
+// size class of a request: <= 64, 512, 4K, 32K, 256K bytes, and larger
+//
+static inline int lat_class(size_t size)
+{
+  size_t limit = 64;
+  int c = 0;
+
+  while ((size > limit) && (c < LAT_CLASSES - 1)) {
+    limit <<= 3;
+    c++;
+  }
+
+  return c;
+}
+
+//
+// smallest request size of size class c (0 for the first class)
+//
+static inline size_t lat_class_lower(int c)
+{
+  return c ? ((size_t)64 << (3 * (c - 1))) + 1 : 0;
+}
+
+//
+// latency bucket of ticks
+//
+static inline int lat_bucket(uint64_t ticks)
+{
+  int e, k;
+
+  if (ticks < LAT_SUB) return (int)ticks;
+
+  e = 63 - __builtin_clzll(ticks);
+  k = (e - LAT_SUB_BITS + 1) * LAT_SUB +
+      (int)((ticks >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+
+  return k < LAT_BUCKETS ? k : LAT_BUCKETS - 1;
+}
+
+//
+// smallest latency in bucket k
+//
+static inline uint64_t lat_lower(int k)
+{
+  int e;
+
+  if (k < LAT_SUB) return k;
+
+  e = k / LAT_SUB + LAT_SUB_BITS - 1;
+  return (uint64_t)(LAT_SUB + k % LAT_SUB) << (e - LAT_SUB_BITS);
+}
+
+//
+// count a call
+//
+//   l          latency statistics of the calling thread
+//   op         call type (EV_*)
+//   size       requested size
+//   ticks      latency
+//
+// returns true if the call is among the slowest so far; the caller then
+// passes it to lat_slow()
+//
+static inline bool lat_record(latency *l, int op, size_t size, uint64_t ticks)
+{
+  l->hist[op][lat_class(size)][lat_bucket(ticks)]++;
+
+  return (l->n_slow < LAT_SLOWEST) || (ticks > l->min_slow);
+}
+
+//
+// add a call to the slowest calls, replacing the fastest one if the list
+// is full
+//
+void lat_slow(latency *l, int op, size_t size, uint64_t ticks,
+              struct __site *site);
+
+//
+// add the statistics of l to total
+//
+// l may be updated concurrently by its thread; the counters are read
+// individually
+//
+void lat_merge(latency *total, latency *l);
+
+//
+// get a percentile from a histogram
+//
+//   hist       LAT_BUCKETS counters
+//   q          quantile (0 < q <= 1)
+//
+// returns the upper bound of the bucket holding the quantile, 0 if the
+// histogram is empty
+//
+uint64_t lat_percentile(const unsigned long *hist, double q);
+
+#endif
@@ -1,123 +1,229 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
-#include <dlfcn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "memlist.h"
+#include "mempool.h"
 
 //
-// function pointers to stdlib's malloc/free implementation
+// slot array of the block table
 //
-static void *(*callocp)(size_t nelem, size_t size) = NULL;
-static void (*freep)(void *ptr) = NULL;
+//   prev       the slot array this one replaced (kept alive for readers)
+//   mask       number of slots - 1
+//   slot       2^n item pointers, NULL marks an empty slot
+//
+typedef struct __slots {
+  struct __slots *prev;
+  size_t mask;
+  item *slot[];
+} slots;
 
-item *new_list(void)
+//
+// block table: the dummy list head followed by an open-addressing hash
+// table (linear probing) mapping block pointers to items.
+//
+//   head       dummy list element (must be first, new_list() returns &head)
+//   tail       last item in the list; new items are appended here
+//   cur        current slot array
+//   used       number of occupied slots
+//   items      slab pool the items are allocated from
+//
+// since we are tracing memory (de-)allocations the table cannot use
+// malloc/free; all of its memory is mapped directly (see mempool.h).
+//
+// Items are never removed from the table (freed blocks remain with cnt == 0
+// so that double frees can be detected), hence no tombstones are needed.
+//
+// A table has a single writer (alloc) but may be searched (find, dealloc)
+// and enumerated by other threads at the same time. Items and slot arrays
+// are published with release stores, and replaced slot arrays are only
+// released in free_list() so that a concurrent reader never probes freed
+// memory.
+//
+typedef struct __table {
+  item head;
+  item *tail;
+  slots *cur;
+  size_t used;
+  pool items;
+} table;
+
+#define TABLE_MIN_SLOTS   1024
+
+static inline table *to_table(item *list)
+{
+  return (table*)list;
+}
+
+static inline size_t hash(void *ptr)
 {
-  // since we are tracing memory (de-)allocations we cannot use
-  // calloc/free directly. We need to make sure that we call the
-  // implementations in stdlib in order not to have them caught 
-  // by our own tracer library.
-  char *error;
-
-  dlerror();
-
-  callocp = dlsym(RTLD_NEXT, "calloc");
-  if (((error = dlerror()) != NULL) || (callocp == NULL)) {
-    fprintf(stderr, "Error getting symbol 'calloc': %s\n", error);
-    exit(EXIT_FAILURE);
+  // blocks are at least 16-byte aligned; drop the always-zero bits and
+  // spread the rest with a Fibonacci multiplier
+  uint64_t h = ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL;
+  return (size_t)(h ^ (h >> 32));
+}
+
+//
+// return the slot holding ptr or the empty slot where it would be inserted
+//
+static item **probe(slots *s, void *ptr)
+{
+  size_t i = hash(ptr) & s->mask;
+  item *cur;
+
+  while (((cur = __atomic_load_n(&s->slot[i], __ATOMIC_ACQUIRE)) != NULL) &&
+         (cur->ptr != ptr)) {
+    i = (i + 1) & s->mask;
   }
 
-  freep = dlsym(RTLD_NEXT, "free");
-  if (((error = dlerror()) != NULL) || (freep == NULL)) {
-    fprintf(stderr, "Error getting symbol 'free': %s\n", error);
-    exit(EXIT_FAILURE);
+  return &s->slot[i];
+}
+
+static inline size_t slots_size(size_t n)
+{
+  return sizeof(slots) + n * sizeof(item*);
+}
+
+static slots *new_slots(size_t n)
+{
+  slots *s = (slots*)meta_map(slots_size(n));
+
+  if (s != NULL) s->mask = n - 1;
+  return s;
+}
+
+//
+// double the number of slots and re-insert all items
+//
+static int grow(table *t)
+{
+  slots *s;
+  item *i;
+
+  s = new_slots((t->cur->mask + 1) << 1);
+  if (s == NULL) return -1;
+
+  for (i = t->head.next; i != NULL; i = i->next) {
+    *probe(s, i->ptr) = i;
   }
 
+  s->prev = t->cur;
+  __atomic_store_n(&t->cur, s, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+item *new_list(void)
+{
+  table *t;
+
   // create new list
-  return (item*)callocp(1, sizeof(item));
+  t = (table*)meta_map(sizeof(table));
+  if (t == NULL) return NULL;
+
+  t->cur = new_slots(TABLE_MIN_SLOTS);
+  if (t->cur == NULL) {
+    meta_unmap(t, sizeof(table));
+    return NULL;
+  }
+  t->tail = &t->head;
+  pool_init(&t->items, sizeof(item));
+
+  return &t->head;
 }
 
 void free_list(item *list)
 {
-  item *next;
+  table *t;
+  slots *s, *prev;
+
+  if (list == NULL) return;
 
-  while (list) {
-    next = list->next;
-    freep(list);
-    list = next;
+  t = to_table(list);
+  pool_release(&t->items);
+
+  for (s = t->cur; s != NULL; s = prev) {
+    prev = s->prev;
+    meta_unmap(s, slots_size(s->mask + 1));
   }
+  meta_unmap(t, sizeof(table));
 }
 
 item *alloc(item *list, void *ptr, size_t size)
 {
-  item *prev, *cur, *i;
-  int res;
+  table *t;
+  item **s, *i;
 
   if (list == NULL) return NULL;
 
-  i = (item*)callocp(1, sizeof(item));
+  t = to_table(list);
+
+  // check if block already exists
+  s = probe(t->cur, ptr);
+  if (*s != NULL) {
+    // existing block -> update size & reference counter
+    i = *s;
+    i->size = size;
+    __atomic_fetch_add(&i->cnt, 1, __ATOMIC_RELEASE);
+    return i;
+  }
+
+  // new block -> insert into table and append to list
+  i = (item*)pool_alloc(&t->items);
+  if (i == NULL) return NULL;
   i->ptr = ptr;
   i->size = size;
   i->cnt = 1;
 
-  // check if block already exists
-  prev = list; cur = list->next;
-  while ((cur != NULL) && (cur->ptr < i->ptr)) {
-    prev = cur; cur = cur->next;
-  }
+  __atomic_store_n(s, i, __ATOMIC_RELEASE);
+  __atomic_store_n(&t->tail->next, i, __ATOMIC_RELEASE);
+  t->tail = i;
 
-  if (cur == NULL) {
-    // new block -> insert into list
-    prev->next = i;
-  } else {
-    if (cur->ptr == i->ptr) {
-      // existing block -> update size & reference counter
-      cur->size = i->size;
-      cur->cnt++;
-      freep(i);
-      i = cur;
-    } else {
-      // new block -> insert into list
-      i->next = cur;
-      prev->next = i;
-    }
-  }
+  // keep the load factor below 1/2 so that probe sequences stay short
+  if (++t->used * 2 > t->cur->mask + 1) grow(t);
 
   return i;
 }
 
 item *dealloc(item *list, void *ptr)
 {
-  item *prev, *cur, *i;
-
-  if (list == NULL) return NULL;
+  item *cur;
 
-  // find block
-  prev = list; cur = list->next;
-  while ((cur != NULL) && (cur->ptr != ptr)) {
-    prev = cur; cur = cur->next;
-  }
+  cur = find(list, ptr);
 
   // decrement reference count if found
-  if (cur != NULL) cur->cnt--;
+  if (cur != NULL) __atomic_fetch_sub(&cur->cnt, 1, __ATOMIC_ACQ_REL);
 
   return cur;
 }
 
-item *find(item *list, void *ptr)
+int release(item *i)
 {
-  if (list == NULL) return NULL;
+  int cnt = __atomic_load_n(&i->cnt, __ATOMIC_ACQUIRE);
 
-  list = list->next;
-  while ((list != NULL) && (ptr > list->ptr)) {
-    list = list->next;
+  while (cnt > 0) {
+    if (__atomic_compare_exchange_n(&i->cnt, &cnt, cnt - 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return 1;
+    }
   }
 
-  if ((list != NULL) && (list->ptr == ptr)) return list;
-  else return NULL;
+  return 0;
+}
+
+item *find(item *list, void *ptr)
+{
+  table *t;
+
+  if (list == NULL) return NULL;
+
+  t = to_table(list);
+  return __atomic_load_n(probe(__atomic_load_n(&t->cur, __ATOMIC_ACQUIRE), ptr),
+                         __ATOMIC_ACQUIRE);
 }
 
 void dump_list(item *list)
@@ -2,6 +2,7 @@
 #define __MEMLIST_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 //
 // list element holding information about an allocated memory block
@@ -9,13 +10,35 @@
 //   ptr        pointer to block
 //   size       size of block
 //   cnt        allocate count
+//   site       call site that allocated the block (see memsite.h) or NULL
+//   tsc        time stamp of the allocation (clock_ticks())
+//   seq        allocation clock of the allocating shard at the allocation,
+//              for block lifetimes (see memtrace.c)
+//   chain      number of reallocs that led to this block (0 if the block was
+//              not created by realloc)
+//   first      size of the block that started the realloc chain
+//   copied     bytes copied by the reallocs of the chain that moved the block
+//   origin     call site that allocated the block that started the chain
+//   tid        kernel thread id of the thread that allocated the block
 //
 //   next       pointer to next item in linked list
 //
+// items are indexed by ptr in an open-addressing hash table; the linked
+// list only chains all items in insertion order so that they can be
+// enumerated (e.g., to report non-deallocated blocks).
+//
 typedef struct __item {
   void *ptr;
   size_t size;
   int cnt;
+  struct __site *site;
+  uint64_t tsc;
+  unsigned long seq;
+  unsigned int chain;
+  size_t first;
+  size_t copied;
+  struct __site *origin;
+  int tid;
   struct __item *next;
 } item;
 
@@ -24,6 +47,9 @@ typedef struct __item {
 // initialize a new list.
 // The first element is a dummy element
 //
+// the dummy element is embedded in the block table; walking the list through
+// the next pointers visits every item ever allocated.
+//
 item *new_list(void);
 
 //
@@ -60,6 +86,20 @@ item *alloc(item *list, void *ptr, size_t size);
 //
 item *dealloc(item *list, void *ptr);
 
+//
+// atomically decrement the reference count of an item if it is positive
+//
+//    i         pointer to item
+//
+// returns
+//    int       1 if the reference count was decremented, 0 if it already was
+//              zero (i.e., the block has been freed before)
+//
+// unlike dealloc() this may be called concurrently on the same item, e.g., by
+// a thread freeing a block that another thread allocated.
+//
+int release(item *i);
+
 //
 // find information about a block in list
 //
@@ -69,6 +109,11 @@ item *dealloc(item *list, void *ptr);
 // returns
 //    item*     pointer to item holding information about the block
 //
+// alloc, dealloc and find run in expected constant time regardless of the
+// number of blocks in the list. find may be called from any thread while the
+// thread owning the list is adding blocks; alloc must only be called by the
+// owner.
+//
 item *find(item *list, void *ptr);
 
 //
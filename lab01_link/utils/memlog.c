@@ -1,19 +1,36 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#define MLOG_MAX 512
+
+static FILE *out = NULL;
+
+void mlog_stream(FILE *f)
+{
+  out = f;
+}
+
 int mlog(const char *fmt, ...)
 {
   static unsigned int id = 1;
+  char buf[MLOG_MAX];
   va_list ap;
-  int res;
+  int res, n;
 
-  res = fprintf(stderr, "[%04u] ", id++);
+  // format the whole line first and hand it to stdio in a single call so that
+  // lines of concurrent threads do not interleave
+  res = snprintf(buf, sizeof(buf), "[%04u] ",
+                 __atomic_fetch_add(&id, 1, __ATOMIC_RELAXED));
 
   va_start(ap, fmt);
-  res += vfprintf(stderr, fmt, ap);
+  n = vsnprintf(buf + res, sizeof(buf) - res - 1, fmt, ap);
   va_end(ap);
 
-  fprintf(stderr, "\n");
+  if (n > (int)sizeof(buf) - res - 2) n = sizeof(buf) - res - 2;
+  res += n;
+
+  buf[res] = '\n';
+  fwrite(buf, 1, res + 1, out ? out : stderr);
 
   return res;
 }
@@ -20,6 +20,17 @@
 #define LOG_CALLOC(nmemb, size, res)  mlog("%9c calloc( %zu , %zu ) = %p", ' ', nmemb, size, res)
 #define LOG_REALLOC(ptr, size, res)   mlog("%9c realloc( %p , %zu ) = %p", ' ', ptr, size, res)
 #define LOG_FREE(ptr)                 mlog("%9c free( %p )", ' ', ptr)
+#define LOG_MEMALIGN(align, size, res) mlog("%9c memalign( %zu , %zu ) = %p", ' ', align, size, res)
+#define LOG_NEW(align, size, res) \
+  ((align) ? mlog("%9c operator new( %zu , align %zu ) = %p", ' ', size, align, res) \
+           : mlog("%9c operator new( %zu ) = %p", ' ', size, res))
+#define LOG_DELETE(ptr)               mlog("%9c operator delete( %p )", ' ', ptr)
+#define LOG_MMAP(len, prot, flags, res) \
+  mlog("%9c mmap( %zu , prot 0x%x , flags 0x%x ) = %p", ' ', len, prot, flags, res)
+#define LOG_MUNMAP(ptr, len)          mlog("%9c munmap( %p , %zu )", ' ', ptr, len)
+#define LOG_MREMAP(ptr, len, res)     mlog("%9c mremap( %p , %zu ) = %p", ' ', ptr, len, res)
+#define LOG_BRK(ptr, res)             mlog("%9c brk( %p ) = %d", ' ', ptr, res)
+#define LOG_SBRK(incr, res)           mlog("%9c sbrk( %ld ) = %p", ' ', incr, res)
 
 
 //
@@ -33,6 +44,126 @@
     mlog("  freed_total          %lu", free_total); \
   }
 
+//
+// log the number of rejected deallocations
+//
+#define LOG_INVALID_FREES(n_double, n_illegal) \
+  { mlog(""); \
+    mlog("Invalid frees (ignored)"); \
+    mlog("  double_free          %lu", n_double); \
+    mlog("  illegal_free         %lu", n_illegal); \
+  }
+
+//
+// log the call counters (counters-only build of memtrace)
+//
+#define LOG_CALLS(n_malloc, n_calloc, n_realloc, n_memalign, n_new, n_free, alloc_total) \
+  { mlog(""); \
+    mlog("Calls"); \
+    mlog("  malloc               %lu", n_malloc); \
+    mlog("  calloc               %lu", n_calloc); \
+    mlog("  realloc              %lu", n_realloc); \
+    mlog("  memalign             %lu", n_memalign); \
+    mlog("  operator new         %lu", n_new); \
+    mlog("  free/delete          %lu", n_free); \
+    mlog("  allocated_total      %lu", alloc_total); \
+  }
+
+//
+// log the peak footprint
+//
+//   peak_ms    time of peak_bytes in milliseconds since the start
+//   live_*     live bytes/blocks at exit
+//
+#define LOG_PEAK(peak_bytes, peak_blocks, peak_ms, live_bytes, live_blocks) \
+  { mlog("  peak_bytes           %lu (at %.3f ms)", peak_bytes, peak_ms); \
+    mlog("  peak_blocks          %lu", peak_blocks); \
+    mlog("  live_bytes           %lu", live_bytes); \
+    mlog("  live_blocks          %lu", live_blocks); \
+  }
+
+//
+// log the memory the program obtained from the OS and how much of the malloc
+// heap the live blocks account for
+//
+//   mapped     bytes currently mapped by the program with mmap/mremap
+//   peak       peak of mapped
+//   brk        bytes the program added to the heap with brk/sbrk
+//   heap       bytes the allocator obtained from the OS (arena and mmapped
+//              chunks)
+//   live       bytes requested by the live blocks
+//   overhead   bytes of the allocated chunks not requested (headers,
+//              rounding, untraced blocks)
+//   free       bytes of free chunks in the heap (fragmentation, top chunk)
+//   rss        resident set size of the process (-1 if unknown)
+//
+#define LOG_OS_MEMORY(n_mmap, n_munmap, n_mremap, n_brk, mapped, peak, brk) \
+  { mlog(""); \
+    mlog("OS memory"); \
+    mlog("  calls                mmap %lu, munmap %lu, mremap %lu, brk/sbrk %lu", n_mmap, n_munmap, n_mremap, n_brk); \
+    mlog("  mapped_bytes         %ld (peak %ld)", mapped, peak); \
+    mlog("  brk_bytes            %ld", brk); \
+  }
+#define LOG_HEAP(heap, live, overhead, free, rss) \
+  { mlog("  malloc_heap_bytes    %zu", heap); \
+    mlog("    live_bytes         %zu (%.1f%%)", live, heap ? 100.0 * (live) / (heap) : 0.0); \
+    mlog("    overhead_bytes     %zu (%.1f%%)", overhead, heap ? 100.0 * (overhead) / (heap) : 0.0); \
+    mlog("    free_bytes         %zu (%.1f%%)", free, heap ? 100.0 * (free) / (heap) : 0.0); \
+    mlog("  rss_bytes            %ld", rss); \
+  }
+
+//
+// log the call sites that mapped the most memory
+//
+#define LOG_MAP_SITES_START(n) \
+  { mlog(""); \
+    mlog("Mapping sites (top %d by bytes mapped)", n); \
+    mlog("  %-10s   %-12s   %s", "calls", "bytes", "site"); \
+  }
+#define LOG_MAP_SITE(n, bytes, name) \
+  mlog("  %-10lu   %-12lu   %s", n, bytes, name)
+#define LOG_MAP_SITE_FRAME(name)      mlog("  %29c %s", ' ', name)
+
+//
+// log the page occupancy of the live blocks (see memfrag.h)
+//
+//   page       page size
+//   pages      touched pages (holding live bytes)
+//   live       live bytes in these pages
+//   pinned     pages kept by a single small block below limit percent use
+//   unused     unused bytes of the pinned pages
+//
+#define LOG_PAGES(page, pages, live, pinned, unused, limit) \
+  { mlog(""); \
+    mlog("Page occupancy (%d-byte pages)", page); \
+    mlog("  touched_pages        %zu (%lu bytes)", pages, (unsigned long)(pages) * (page)); \
+    mlog("  live_bytes           %lu (%.1f%% of the touched pages)", live, (pages) ? 100.0 * (live) / ((double)(pages) * (page)) : 0.0); \
+    mlog("  pinned_pages         %lu (%lu bytes unused; one live block, < %d%% in use)", pinned, unused, limit); \
+    mlog("  %-13s   %-10s   %-6s", "in use", "pages", "%"); \
+  }
+#define LOG_PAGE_OCCUPANCY(lo, hi, n, pct) \
+  mlog("  %3d-%3d%%        %-10lu   %6.2f", lo, hi, n, pct)
+#define LOG_PINS_START(n) \
+  { mlog(""); \
+    mlog("Sites of blocks pinning pages (top %d by pages)", n); \
+    mlog("  %-10s   %-12s   %s", "pages", "unused", "site"); \
+  }
+#define LOG_PIN(pages, unused, name) \
+  mlog("  %-10lu   %-12lu   %s", pages, unused, name)
+#define LOG_PIN_FRAME(name)           mlog("  %29c %s", ' ', name)
+
+//
+// log the memory used by the tracer itself
+//
+//   bytes      bytes mapped for tables, shards and event rings
+//   pct        bytes relative to the peak footprint of the traced program
+//
+#define LOG_OVERHEAD(bytes, pct) \
+  { mlog(""); \
+    mlog("Tracer overhead"); \
+    mlog("  metadata_bytes       %zu (%.1f%% of peak_bytes)", bytes, pct); \
+  }
+
 //
 // log statistics about memory blocks
 //
@@ -43,6 +174,166 @@
   }
 #define LOG_BLOCK(ptr, size, cnt) mlog("  %-16p   %-8zd   %-7d", ptr, size, cnt)
 
+//
+// log statistics about allocation sizes
+//
+#define LOG_SIZES_START() \
+  { mlog(""); \
+    mlog("Allocation sizes"); \
+    mlog("  %-21s   %-10s   %-12s   %-12s", "size", "calls", "bytes", "live bytes"); \
+  }
+#define LOG_SIZE(lo, hi, n, bytes, live) \
+  mlog("  %10lu-%-10lu   %-10lu   %-12lu   %-12lu", lo, hi, n, bytes, live)
+
+#define LOG_TOP_SIZES_START(n) \
+  { mlog(""); \
+    mlog("Most frequent sizes (top %d by calls)", n); \
+    mlog("  %-10s   %-10s   %-12s   %-12s", "size", "calls", "bytes", "live bytes"); \
+  }
+#define LOG_TOP_SIZE(size, n, bytes, live) \
+  mlog("  %-10lu   %-10lu   %-12lu   %-12lu", size, n, bytes, live)
+
+//
+// log statistics about block lifetimes
+//
+//   unit       unit of the lifetime ("allocations", "ns")
+//   pct        percentage of all freed blocks
+//
+#define LOG_LIFETIMES_START(unit) \
+  { mlog(""); \
+    mlog("Block lifetimes (%s)", unit); \
+    mlog("  %-27s   %-10s   %-6s", "lifetime", "blocks", "%"); \
+  }
+#define LOG_LIFETIME(lo, hi, n, pct) \
+  mlog("  %13lu-%-13lu   %-10lu   %6.2f", lo, hi, n, pct)
+
+//
+// log short-lived small blocks (candidates for object pools)
+//
+//   pct        percentage of the blocks allocated in this size range
+//
+#define LOG_SHORT_START(size, allocs) \
+  { mlog(""); \
+    mlog("Short-lived small blocks (<= %lu bytes, freed within %lu allocations)", size, allocs); \
+    mlog("  %-21s   %-10s   %-6s", "size", "blocks", "%"); \
+  }
+#define LOG_SHORT(lo, hi, n, pct) \
+  mlog("  %10lu-%-10lu   %-10lu   %6.2f", lo, hi, n, pct)
+
+//
+// log the latency of the allocator per call type and size class and the
+// slowest calls
+//
+#define LOG_LATENCY_START() \
+  { mlog(""); \
+    mlog("Allocator latency (ns)"); \
+    mlog("  %-15s   %-21s   %-10s   %-10s   %-10s   %-10s", "call", "size", "calls", "p50", "p99", "p99.9"); \
+  }
+#define LOG_LATENCY(op, lo, hi, n, p50, p99, p999) \
+  mlog("  %-15s   %10lu-%-10lu   %-10lu   %-10lu   %-10lu   %-10lu", op, lo, hi, n, p50, p99, p999)
+#define LOG_SLOWEST_START(n) \
+  { mlog(""); \
+    mlog("Slowest allocator calls (top %d)", n); \
+    mlog("  %-10s   %-15s   %-10s   %s", "ns", "call", "size", "site"); \
+  }
+#define LOG_SLOW(ns, op, size, name) \
+  mlog("  %-10lu   %-15s   %-10zu   %s", ns, op, size, name)
+
+//
+// log the sampling interval (all statistics are estimates)
+//
+#define LOG_SAMPLING(interval) \
+  { mlog(""); \
+    mlog("Sampling one allocation every %lu bytes; counts are estimates", interval); \
+  }
+
+//
+// log statistics about allocation call sites
+//
+#define LOG_SITES_START(n) \
+  { mlog(""); \
+    mlog("Allocation sites (top %d by bytes allocated)", n); \
+    mlog("  %-10s   %-12s   %-12s   %s", "calls", "bytes", "live bytes", "site"); \
+  }
+#define LOG_SITE(n, bytes, live, name) \
+  mlog("  %-10lu   %-12lu   %-12lu   %s", n, bytes, live, name)
+#define LOG_SITE_FRAME(name)          mlog("  %44c %s", ' ', name)
+
+//
+// log statistics about realloc chains
+//
+//   first      largest initial size of the chains
+//   reserve    suggested initial size (largest final size of the chains)
+//
+#define LOG_CHAINS_START(n) \
+  { mlog(""); \
+    mlog("Realloc chains (top %d sites by bytes copied)", n); \
+    mlog("  %-8s   %-8s   %-12s   %-10s   %-10s   %s", "chains", "reallocs", "copied", "first", "reserve", "site"); \
+  }
+#define LOG_CHAIN(n, grows, copied, first, reserve, name) \
+  mlog("  %-8lu   %-8lu   %-12lu   %-10lu   %-10lu   %s", n, grows, copied, first, reserve, name)
+#define LOG_CHAIN_ORIGIN(name)        mlog("  %62c started at %s", ' ', name)
+
+//
+// log blocks freed by another thread than the one that allocated them
+//
+//   share      percentage of the freed blocks of the allocating thread
+//              (threads) or site (sites)
+//
+#define LOG_THREADS_START(n, blocks, bytes, pct) \
+  { mlog(""); \
+    mlog("Cross-thread frees (%lu blocks, %lu bytes, %.1f%% of the freed blocks; top %d pairs)", blocks, bytes, pct, n); \
+    mlog("  %-10s   %-10s   %-10s   %-12s   %7s", "alloc tid", "free tid", "blocks", "bytes", "share"); \
+  }
+#define LOG_THREAD_PAIR(atid, ftid, blocks, bytes, share, note) \
+  mlog("  %-10d   %-10d   %-10lu   %-12lu   %6.1f%%   %s", atid, ftid, blocks, bytes, share, note)
+#define LOG_REMOTE_SITES_START(n) \
+  { mlog(""); \
+    mlog("Sites of blocks freed by other threads (top %d by blocks)", n); \
+    mlog("  %-10s   %-12s   %7s   %s", "blocks", "bytes", "share", "site"); \
+  }
+#define LOG_REMOTE_SITE(blocks, bytes, share, name) \
+  mlog("  %-10lu   %-12lu   %6.1f%%   %s", blocks, bytes, share, name)
+
+//
+// log call sites whose blocks could be served by an object pool
+//
+//   calls      allocator calls a pool would save (a malloc and a free per
+//              short-lived block)
+//   share      percentage of the site's freed blocks that were short-lived
+//   min, max   smallest and largest requested size (max is the slot size of
+//              the pool)
+//
+#define LOG_POOLS_START(n, allocs, us) \
+  { mlog(""); \
+    mlog("Pool candidates (top %d sites by allocator calls saved; freed within %lu allocations or %lu us)", n, allocs, us); \
+    mlog("  %-12s   %-10s   %7s   %-8s   %-8s   %s", "calls", "blocks", "short", "min", "max", "site"); \
+  }
+#define LOG_POOL(calls, blocks, share, min, max, name) \
+  mlog("  %-12lu   %-10lu   %6.1f%%   %-8lu   %-8lu   %s", calls, blocks, share, min, max, name)
+#define LOG_POOL_FRAME(name)          mlog("  %59c %s", ' ', name)
+
+//
+// log the result of replaying a trace (memtrace-replay)
+//
+//   secs       wall-clock time of the replay
+//   rate       calls per second
+//   busy       seconds spent in the allocator, summed over all threads
+//   rss, base  peak resident set size during and before the replay (kB)
+//
+#define LOG_REPLAY(alloc, mode, threads, calls, failed, secs, rate, busy) \
+  { mlog(""); \
+    mlog("Replay"); \
+    mlog("  allocator            %s", alloc); \
+    mlog("  mode                 %s (%d threads)", mode, threads); \
+    mlog("  calls                %lu (%lu allocations failed)", calls, failed); \
+    mlog("  seconds              %.3f", secs); \
+    mlog("  calls_per_second     %.0f", rate); \
+    mlog("  allocator_seconds    %.3f", busy); \
+  }
+#define LOG_REPLAY_RSS(rss, base, note) \
+  mlog("  peak_rss_kb          %lu (%lu before the replay)%s", rss, base, note)
+
 //
 // log invalid deallocation requests
 //
@@ -63,4 +354,11 @@
 //
 int mlog(const char *fmt, ...);
 
+//
+// redirect the log (default: stderr)
+//
+//   f          stream to log to
+//
+void mlog_stream(FILE *f);
+
 #endif
@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include "mempool.h"
+
+#define POOL_CHUNK      (16 * 1024)
+#define POOL_ALIGN      16
+
+static size_t mapped = 0;
+
+static size_t round_page(size_t size)
+{
+  size_t page = 4096;
+
+  return (size + page - 1) & ~(page - 1);
+}
+
+void *meta_map(size_t size)
+{
+  void *p;
+
+  size = round_page(size);
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  if (p == MAP_FAILED) return NULL;
+
+  __atomic_fetch_add(&mapped, size, __ATOMIC_RELAXED);
+
+  return p;
+}
+
+void meta_unmap(void *ptr, size_t size)
+{
+  if (ptr == NULL) return;
+
+  size = round_page(size);
+  munmap(ptr, size);
+  __atomic_fetch_sub(&mapped, size, __ATOMIC_RELAXED);
+}
+
+size_t meta_bytes(void)
+{
+  return __atomic_load_n(&mapped, __ATOMIC_RELAXED);
+}
+
+void pool_init(pool *p, size_t size)
+{
+  p->size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+  p->chunk = NULL;
+  p->left = 0;
+  p->n = 0;
+}
+
+void *pool_alloc(pool *p)
+{
+  char *c;
+
+  if (p->left < p->size) {
+    c = meta_map(POOL_CHUNK);
+    if (c == NULL) return NULL;
+
+    *(char**)c = p->chunk;
+    p->chunk = c;
+    p->left = POOL_CHUNK - POOL_ALIGN;
+  }
+
+  // objects are handed out from the end of the chunk towards its header
+  p->left -= p->size;
+  p->n++;
+
+  return p->chunk + POOL_ALIGN + p->left;
+}
+
+void pool_release(pool *p)
+{
+  char *c, *prev;
+
+  for (c = p->chunk; c != NULL; c = prev) {
+    prev = *(char**)c;
+    meta_unmap(c, POOL_CHUNK);
+  }
+
+  pool_init(p, p->size);
+}
@@ -0,0 +1,70 @@
+#ifndef __MEMPOOL_H__
+#define __MEMPOOL_H__
+
+#include <stddef.h>
+
+//
+// memory for the tracer's own data structures
+//
+// All metadata (block and site tables, shards, event rings) is obtained
+// directly from the kernel with mmap so that the tracer neither calls the
+// allocator it traces nor shares address ranges with the traced heap.
+//
+
+//
+// map/unmap zero-initialized memory
+//
+//   size       number of bytes (rounded up to pages)
+//
+// returns
+//    void*     pointer to the memory or NULL on error
+//
+void *meta_map(size_t size);
+void meta_unmap(void *ptr, size_t size);
+
+//
+// number of bytes currently mapped by meta_map() and the pools
+//
+size_t meta_bytes(void);
+
+//
+// slab pool of fixed-size objects
+//
+//   size       object size
+//   chunk      current chunk; the first word of a chunk links to the
+//              previous one
+//   left       number of unused bytes in the current chunk
+//   n          number of objects handed out
+//
+// objects are carved from 16 KiB chunks and are only released all at once
+// with pool_release(). A pool has a single writer.
+//
+typedef struct __pool {
+  size_t size;
+  char *chunk;
+  size_t left;
+  size_t n;
+} pool;
+
+//
+// initialize a pool
+//
+//   p          pointer to pool
+//   size       object size
+//
+void pool_init(pool *p, size_t size);
+
+//
+// get a zero-initialized object
+//
+// returns
+//    void*     pointer to object or NULL if no memory could be mapped
+//
+void *pool_alloc(pool *p);
+
+//
+// release all objects of a pool
+//
+void pool_release(pool *p);
+
+#endif
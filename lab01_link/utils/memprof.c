@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+#include "memprof.h"
+#include "memshard.h"
+
+//
+// blocks and bytes of a site still in use; frees are counted by other
+// threads and may be seen before the allocation
+//
+static unsigned long in_use(unsigned long alloc, unsigned long freed)
+{
+  return alloc > freed ? alloc - freed : 0;
+}
+
+static int copy_maps(FILE *f)
+{
+  FILE *maps;
+  char buf[4096];
+  size_t n;
+
+  if ((maps = fopen("/proc/self/maps", "re")) == NULL) return -1;
+  while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) fwrite(buf, 1, n, f);
+  fclose(maps);
+
+  return 0;
+}
+
+int prof_write(const char *path)
+{
+  FILE *f;
+  site *all, *s;
+  shard *sh;
+  unsigned long n_inuse = 0, n_inuseb = 0, n_alloc = 0, n_allocb = 0;
+  int d, res;
+
+  if ((all = new_sites()) == NULL) return -1;
+
+  // the same call site may have been seen by several threads
+  for (sh = shard_first(); sh != NULL; sh = sh->next) {
+    for (s = sh->sites->next; s != NULL; s = __atomic_load_n(&s->next, __ATOMIC_ACQUIRE)) {
+      merge_site(all, s);
+    }
+  }
+
+  for (s = all->next; s != NULL; s = s->next) {
+    n_inuse += in_use(s->n_alloc, s->n_free);
+    n_inuseb += in_use(s->n_allocb, s->n_freeb);
+    n_alloc += s->n_alloc;
+    n_allocb += s->n_allocb;
+  }
+
+  if ((f = fopen(path, "we")) == NULL) {
+    free_sites(all);
+    return -1;
+  }
+
+  fprintf(f, "heap profile: %lu: %lu [%lu: %lu] @ heapprofile\n",
+          n_inuse, n_inuseb, n_alloc, n_allocb);
+
+  for (s = all->next; s != NULL; s = s->next) {
+    if ((s->n_alloc == 0) || (s->depth == 0)) continue;
+
+    fprintf(f, "%lu: %lu [%lu: %lu] @", in_use(s->n_alloc, s->n_free),
+            in_use(s->n_allocb, s->n_freeb), s->n_alloc, s->n_allocb);
+    for (d = 0; d < s->depth; d++) fprintf(f, " %p", s->pc[d]);
+    fprintf(f, "\n");
+  }
+
+  fprintf(f, "\nMAPPED_LIBRARIES:\n");
+  res = copy_maps(f);
+
+  free_sites(all);
+
+  if (fclose(f) != 0) res = -1;
+
+  return res;
+}
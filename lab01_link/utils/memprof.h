@@ -0,0 +1,39 @@
+#ifndef __MEMPROF_H__
+#define __MEMPROF_H__
+
+//
+// heap profiles in the legacy text format of gperftools' heap profiler,
+// which pprof reads (e.g., 'pprof -http=: <program> <file>' or
+// 'go tool pprof <program> <file>'):
+//
+//   heap profile: <in use>: <bytes> [<allocated>: <bytes>] @ heapprofile
+//   <in use>: <bytes> [<allocated>: <bytes>] @ <pc> <pc> ...
+//   ...                                    one line per call site
+//
+//   MAPPED_LIBRARIES:
+//   <contents of /proc/self/maps>
+//
+// The first line holds the totals, the following ones the blocks and bytes
+// still in use and allocated in total per call site, with its return
+// addresses innermost first. pprof turns them into the inuse_objects,
+// inuse_space, alloc_objects and alloc_space sample types and symbolizes the
+// addresses with the mapped libraries.
+//
+// In sampling mode the counts are the estimates of memtrace; the profile is
+// not scaled again by pprof.
+//
+
+//
+// write a heap profile of the call sites of all shards
+//
+//   path       file name
+//
+// returns 0 on success, -1 on error
+//
+// may be called while other threads allocate and free blocks (the counts
+// are read without stopping them). The caller must not be traced (the
+// function allocates).
+//
+int prof_write(const char *path);
+
+#endif
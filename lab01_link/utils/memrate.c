@@ -0,0 +1,105 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "memrate.h"
+
+//
+// output: a file or a connected datagram socket
+//
+static FILE *out = NULL;
+static int sock = -1;
+static rate_sample prev;
+static bool have_prev = false;
+
+int rate_open(const char *target)
+{
+  struct sockaddr_un addr;
+
+  have_prev = false;
+
+  if (strncmp(target, "unix:", 5) != 0) {
+    out = fopen(target, "ae");
+    if (out == NULL) return -1;
+    setvbuf(out, NULL, _IOLBF, 0);
+    return 0;
+  }
+
+  target += 5;
+  if (strlen(target) >= sizeof(addr.sun_path)) return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, target);
+
+  sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (sock < 0) return -1;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(sock);
+    sock = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+//
+// per-second rate of a counter; counters that went backwards (a thread's
+// statistics were recycled) count as unchanged
+//
+static double per_s(unsigned long now, unsigned long then, double secs)
+{
+  return now > then ? (now - then) / secs : 0.0;
+}
+
+void rate_report(const rate_sample *cur)
+{
+  char line[512];
+  double secs;
+  int n;
+
+  if ((out == NULL) && (sock < 0)) return;
+
+  if (!have_prev || (cur->ns <= prev.ns)) {
+    prev = *cur;
+    have_prev = true;
+    return;
+  }
+
+  secs = (cur->ns - prev.ns) / 1e9;
+  n = snprintf(line, sizeof(line),
+               "memtrace pid=%d t=%.3f dt=%.3f alloc_per_s=%.0f "
+               "alloc_bytes_per_s=%.0f free_per_s=%.0f free_bytes_per_s=%.0f "
+               "live_bytes=%lu live_blocks=%lu live_growth_per_s=%.0f\n",
+               (int)getpid(), cur->ns / 1e9, secs,
+               per_s(cur->allocs, prev.allocs, secs),
+               per_s(cur->alloc_bytes, prev.alloc_bytes, secs),
+               per_s(cur->frees, prev.frees, secs),
+               per_s(cur->free_bytes, prev.free_bytes, secs),
+               cur->live_bytes, cur->live_blocks,
+               ((double)cur->live_bytes - (double)prev.live_bytes) / secs);
+  if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+
+  if (out != NULL) fputs(line, out);
+  else send(sock, line, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  prev = *cur;
+}
+
+void rate_detach(void)
+{
+  out = NULL;
+  sock = -1;
+}
+
+void rate_close(void)
+{
+  if (out != NULL) fclose(out);
+  if (sock >= 0) close(sock);
+  rate_detach();
+}
@@ -0,0 +1,75 @@
+#ifndef __MEMRATE_H__
+#define __MEMRATE_H__
+
+#include <stdint.h>
+
+//
+// periodic allocation-rate reports
+//
+// Every interval the counters of the process are compared with those of the
+// previous report and one line of key=value pairs is written:
+//
+//   memtrace pid=<pid> t=<s> dt=<s> alloc_per_s=<n> alloc_bytes_per_s=<n>
+//   free_per_s=<n> free_bytes_per_s=<n> live_bytes=<n> live_blocks=<n>
+//   live_growth_per_s=<n>
+//
+// (on one line). Allocations count malloc, calloc, realloc, the aligned
+// allocation functions and operator new; frees count free and operator
+// delete. live_growth_per_s is negative while the live heap shrinks.
+//
+// The target is a file, to which the lines are appended, or a Unix datagram
+// socket given as 'unix:<path>', to which every line is sent as one datagram
+// (e.g., to a statsd-like collector listening on the socket). A datagram
+// that cannot be sent is dropped.
+//
+// All functions must be called from one thread at a time.
+//
+
+//
+// counters at the time of a report
+//
+//   ns         time since the start of the program in nanoseconds
+//   allocs,
+//   alloc_bytes  number of allocations and bytes allocated so far
+//   frees,
+//   free_bytes number of frees and bytes freed so far
+//   live_bytes,
+//   live_blocks  bytes and blocks currently allocated
+//
+typedef struct __rate_sample {
+  uint64_t ns;
+  unsigned long allocs;
+  unsigned long alloc_bytes;
+  unsigned long frees;
+  unsigned long free_bytes;
+  unsigned long live_bytes;
+  unsigned long live_blocks;
+} rate_sample;
+
+//
+// open the target
+//
+//   target     file name or 'unix:<path>' for a datagram socket
+//
+// returns 0 on success, -1 on error
+//
+int rate_open(const char *target);
+
+//
+// write a report for the interval since the previous call
+//
+//   cur        counters now; the first call only records them
+//
+void rate_report(const rate_sample *cur);
+
+//
+// forget the target without writing to it (child after fork())
+//
+void rate_detach(void);
+
+//
+// close the target
+//
+void rate_close(void);
+
+#endif
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "memshard.h"
+#include "mempool.h"
+
+//
+// registry of all shards (push-only, lock-free) and the calling thread's
+// shard. initial-exec TLS does not allocate on first access.
+//
+static shard *registry = NULL;
+static int n_shards = 0;
+static pthread_key_t key;
+static __thread shard *self __attribute__((tls_model("initial-exec"))) = NULL;
+
+//
+// thread exit: make the shard available to the next new thread
+//
+static void retire(void *arg)
+{
+  shard *s = (shard*)arg;
+
+  self = NULL;
+  __atomic_store_n(&s->active, 0, __ATOMIC_RELEASE);
+}
+
+int shard_init(void)
+{
+  return pthread_key_create(&key, retire) == 0 ? 0 : -1;
+}
+
+//
+// claim the shard of an exited thread
+//
+static shard *recycle(void)
+{
+  shard *s;
+  int inactive;
+
+  for (s = shard_first(); s != NULL; s = s->next) {
+    inactive = 0;
+    if (__atomic_compare_exchange_n(&s->active, &inactive, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return s;
+    }
+  }
+
+  return NULL;
+}
+
+//
+// create and register a new shard. Shards are obtained with meta_map so that
+// creating one does not re-enter malloc.
+//
+static shard *create(void)
+{
+  shard *s;
+
+  s = meta_map(sizeof(shard));
+  if (s == NULL) return NULL;
+
+  s->list = new_list();
+  s->sites = new_sites();
+  s->sizes = new_sites();
+  s->maps = new_sites();
+  s->threads = new_sites();
+  if ((s->list == NULL) || (s->sites == NULL) || (s->sizes == NULL) ||
+      (s->maps == NULL) || (s->threads == NULL)) {
+    free_list(s->list);
+    free_sites(s->sites);
+    free_sites(s->sizes);
+    free_sites(s->maps);
+    free_sites(s->threads);
+    meta_unmap(s, sizeof(shard));
+    return NULL;
+  }
+  s->active = 1;
+  s->id = __atomic_fetch_add(&n_shards, 1, __ATOMIC_RELAXED);
+
+  s->next = __atomic_load_n(&registry, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&registry, &s->next, s, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  return s;
+}
+
+shard *shard_self(void)
+{
+  shard *s = self;
+
+  if (s != NULL) return s;
+
+  s = recycle();
+  if (s == NULL) s = create();
+  if (s == NULL) return NULL;
+
+  s->tid = (int)syscall(SYS_gettid);
+  self = s;
+  pthread_setspecific(key, s);
+
+  return s;
+}
+
+shard *shard_first(void)
+{
+  return __atomic_load_n(&registry, __ATOMIC_ACQUIRE);
+}
+
+item *shard_alloc(shard *s, void *ptr, size_t size)
+{
+  return alloc(s->list, ptr, size);
+}
+
+item *shard_dealloc(shard *s, void *ptr, item **dead)
+{
+  item *i;
+  shard *o;
+
+  *dead = NULL;
+
+  // common case: the block was allocated by this thread
+  i = find(s->list, ptr);
+  if (i != NULL) {
+    if (release(i)) return i;
+    *dead = i;
+  }
+
+  // cross-thread free: look the block up in the other shards. At most one
+  // shard holds a live item for ptr; stale items of earlier blocks at the
+  // same address have a reference count of zero and are skipped.
+  for (o = shard_first(); o != NULL; o = o->next) {
+    if (o == s) continue;
+
+    i = find(o->list, ptr);
+    if (i == NULL) continue;
+    if (release(i)) {
+      *dead = NULL;
+      return i;
+    }
+    *dead = i;
+  }
+
+  return NULL;
+}
+
+void shard_stats(stats *total)
+{
+  shard *s;
+  int k;
+
+  memset(total, 0, sizeof(stats));
+
+  for (s = shard_first(); s != NULL; s = s->next) {
+    for (k = 0; k < HIST_BUCKETS; k++) {
+      total->sz_alloc[k]  += __atomic_load_n(&s->st.sz_alloc[k], __ATOMIC_RELAXED);
+      total->sz_allocb[k] += __atomic_load_n(&s->st.sz_allocb[k], __ATOMIC_RELAXED);
+      total->sz_free[k]   += __atomic_load_n(&s->st.sz_free[k], __ATOMIC_RELAXED);
+      total->sz_freeb[k]  += __atomic_load_n(&s->st.sz_freeb[k], __ATOMIC_RELAXED);
+      total->sz_short[k]  += __atomic_load_n(&s->st.sz_short[k], __ATOMIC_RELAXED);
+      total->lt_allocs[k] += __atomic_load_n(&s->st.lt_allocs[k], __ATOMIC_RELAXED);
+      total->lt_ticks[k]  += __atomic_load_n(&s->st.lt_ticks[k], __ATOMIC_RELAXED);
+    }
+
+    total->n_malloc  += __atomic_load_n(&s->st.n_malloc, __ATOMIC_RELAXED);
+    total->n_calloc  += __atomic_load_n(&s->st.n_calloc, __ATOMIC_RELAXED);
+    total->n_realloc += __atomic_load_n(&s->st.n_realloc, __ATOMIC_RELAXED);
+    total->n_memalign += __atomic_load_n(&s->st.n_memalign, __ATOMIC_RELAXED);
+    total->n_new     += __atomic_load_n(&s->st.n_new, __ATOMIC_RELAXED);
+    total->n_free    += __atomic_load_n(&s->st.n_free, __ATOMIC_RELAXED);
+    total->n_allocb  += __atomic_load_n(&s->st.n_allocb, __ATOMIC_RELAXED);
+    total->n_freeb   += __atomic_load_n(&s->st.n_freeb, __ATOMIC_RELAXED);
+    total->n_double_free += __atomic_load_n(&s->st.n_double_free, __ATOMIC_RELAXED);
+    total->n_illegal_free += __atomic_load_n(&s->st.n_illegal_free, __ATOMIC_RELAXED);
+  }
+}
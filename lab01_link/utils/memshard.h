@@ -0,0 +1,182 @@
+#ifndef __MEMSHARD_H__
+#define __MEMSHARD_H__
+
+#include <stddef.h>
+
+#include "memhist.h"
+#include "memlist.h"
+#include "memsite.h"
+
+//
+// per-thread statistics
+//
+//   n_malloc   number of calls to malloc
+//   n_calloc   number of calls to calloc
+//   n_realloc  number of calls to realloc
+//   n_memalign number of calls to the aligned allocation functions
+//   n_new      number of calls to C++ operator new
+//   n_free     number of calls to free and C++ operator delete
+//   n_allocb   number of bytes allocated
+//   n_freeb    number of bytes freed
+//   n_double_free,
+//   n_illegal_free  number of rejected deallocations of blocks that were
+//              freed before / were never allocated
+//
+//   sz_alloc,
+//   sz_allocb  number of blocks/bytes allocated per size (log2 buckets of
+//              the requested size, see memhist.h)
+//   sz_free,
+//   sz_freeb   number of blocks/bytes freed per size
+//   sz_short   number of blocks freed per size that were short-lived
+//              (see memtrace.c)
+//
+//   lt_allocs  number of freed blocks per lifetime in allocations (log2
+//              buckets of the number of allocations between malloc and free)
+//   lt_ticks   number of freed blocks per lifetime in ticks (log2 buckets)
+//
+// In sampling mode all values are estimates scaled up from the sampled
+// allocations.
+//
+typedef struct __stats {
+  unsigned long n_malloc;
+  unsigned long n_calloc;
+  unsigned long n_realloc;
+  unsigned long n_memalign;
+  unsigned long n_new;
+  unsigned long n_free;
+  unsigned long n_allocb;
+  unsigned long n_freeb;
+  unsigned long n_double_free;
+  unsigned long n_illegal_free;
+  unsigned long sz_alloc[HIST_BUCKETS];
+  unsigned long sz_allocb[HIST_BUCKETS];
+  unsigned long sz_free[HIST_BUCKETS];
+  unsigned long sz_freeb[HIST_BUCKETS];
+  unsigned long sz_short[HIST_BUCKETS];
+  unsigned long lt_allocs[HIST_BUCKETS];
+  unsigned long lt_ticks[HIST_BUCKETS];
+} stats;
+
+//
+// shard holding the tracer state of one thread
+//
+//   st         statistics of the calls made by this thread
+//   list       blocks allocated by this thread
+//   sites      call sites of the blocks allocated by this thread
+//   sizes      blocks allocated/freed by this thread per exact request size,
+//              kept in a site table whose only frame is the size
+//   maps       call sites of the mmap/mremap/brk/sbrk calls of this thread
+//   threads    blocks freed by this thread per allocating thread, kept in a
+//              site table whose frames are the ids of the allocating and the
+//              freeing thread
+//   ring       event ring buffer (see memevent.h), NULL until first used
+//   lat        latency statistics (see memlat.h), NULL until first used
+//   id         shard number (0, 1, 2, ... in order of creation)
+//   tid        kernel thread id of the owning thread
+//   active     1 while a thread owns this shard, 0 after the thread exited
+//   rng        state of the random number generator used for sampling
+//   seq        number of allocations traced in this shard (weighted in
+//              sampling mode), the clock of block lifetimes in allocations
+//   live_bytes,
+//   live_blocks  bytes and blocks allocated in this shard minus those freed
+//              by the owning thread
+//   remote_bytes,
+//   remote_blocks  bytes and blocks of this shard freed by other threads
+//              (added atomically by them); the shard's live heap is
+//              live_* - remote_*
+//   peak_bytes,
+//   peak_blocks  maximum of the shard's live heap, taken by the owning thread
+//              after each allocation
+//   peak_tsc   time stamp of the allocation that reached peak_bytes
+//
+//   next       pointer to next shard in the registry
+//
+// All fields but remote_bytes and remote_blocks are only written by the
+// owning thread. Shards are never freed: when a thread exits its shard is
+// handed to the next new thread, together with the blocks it still tracks.
+//
+typedef struct __shard {
+  stats st;
+  item *list;
+  site *sites;
+  site *sizes;
+  site *maps;
+  site *threads;
+  struct __ring *ring;
+  struct __latency *lat;
+  int id;
+  int tid;
+  int active;
+  uint64_t rng;
+  unsigned long seq;
+  unsigned long live_bytes;
+  unsigned long live_blocks;
+  unsigned long remote_bytes;
+  unsigned long remote_blocks;
+  unsigned long peak_bytes;
+  unsigned long peak_blocks;
+  uint64_t peak_tsc;
+  struct __shard *next;
+} shard;
+
+
+//
+// initialize the shard registry. Must be called once before shard_self()
+//
+// returns 0 on success, -1 on error
+//
+int shard_init(void);
+
+//
+// get the shard of the calling thread, creating (or recycling) it on first
+// use
+//
+// returns
+//    shard*    pointer to the thread's shard or NULL if no shard could be
+//              created
+//
+shard *shard_self(void);
+
+//
+// get the first shard in the registry; iterate with shard->next
+//
+shard *shard_first(void);
+
+//
+// add information about a block allocated by the calling thread
+//
+//   s          shard of the calling thread
+//   ptr        pointer to newly allocated block
+//   size       size of newly allocated block
+//
+// returns
+//    item*     pointer to item holding information about the block
+//
+item *shard_alloc(shard *s, void *ptr, size_t size);
+
+//
+// update information on a block freed by the calling thread
+//
+//   s          shard of the calling thread
+//   ptr        pointer to freed block
+//   dead       set to an item for ptr with reference count zero if ptr was
+//              not found live in any shard, NULL otherwise
+//
+// returns
+//    item*     pointer to the item whose reference count was decremented or
+//              NULL if ptr is not a live block
+//
+// The own shard is searched first; blocks allocated by other threads are
+// looked up in their shards and released with a compare-and-swap on the
+// item, so no locks are taken and concurrent double frees are caught.
+//
+item *shard_dealloc(shard *s, void *ptr, item **dead);
+
+//
+// sum up the statistics of all shards
+//
+//   total      statistics to fill in
+//
+void shard_stats(stats *total);
+
+#endif
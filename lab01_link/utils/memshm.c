@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memshm.h"
+
+#define SHM_RETRIES     1000
+
+shm_stats *shm_create(const char *path)
+{
+  shm_stats *shm;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return NULL;
+
+  if (ftruncate(fd, sizeof(shm_stats)) != 0) {
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+
+  shm = mmap(NULL, sizeof(shm_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    unlink(path);
+    return NULL;
+  }
+
+  shm->version = SHM_VERSION;
+  shm->pid = getpid();
+  // readers check the magic number last
+  __atomic_store_n(&shm->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+  return shm;
+}
+
+void shm_publish(shm_stats *shm, const shm_stats *snap)
+{
+  uint32_t seq = shm->seq;
+  size_t head = offsetof(shm_stats, done);
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy((char*)shm + head, (const char*)snap + head, sizeof(shm_stats) - head);
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+const shm_stats *shm_attach(const char *path)
+{
+  shm_stats *shm;
+  struct stat sb;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  if ((fstat(fd, &sb) != 0) || (sb.st_size != sizeof(shm_stats))) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  shm = mmap(NULL, sizeof(shm_stats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) return NULL;
+
+  if ((__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) ||
+      (shm->version != SHM_VERSION)) {
+    munmap(shm, sizeof(shm_stats));
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return shm;
+}
+
+int shm_read(const shm_stats *shm, shm_stats *snap)
+{
+  uint32_t before, after;
+  int i;
+
+  for (i = 0; i < SHM_RETRIES; i++) {
+    before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (before & 1) {
+      sched_yield();
+      continue;
+    }
+
+    memcpy(snap, shm, sizeof(shm_stats));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    if (before == after) return 0;
+  }
+
+  return -1;
+}
+
+void shm_unmap(const shm_stats *shm)
+{
+  if (shm != NULL) munmap((void*)shm, sizeof(shm_stats));
+}
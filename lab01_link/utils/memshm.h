@@ -0,0 +1,103 @@
+#ifndef __MEMSHM_H__
+#define __MEMSHM_H__
+
+#include <stdint.h>
+
+#include "memshard.h"
+
+//
+// live statistics in shared memory
+//
+// A traced process periodically publishes its statistics into a small file
+// under /dev/shm that other processes map read-only (see memtrace-top). The
+// traced calls themselves never touch it: a background thread sums up the
+// shards and copies the result into the page.
+//
+// Updates are protected by a sequence lock. The writer makes seq odd, copies
+// the new values and makes seq even again; a reader copies the page and
+// retries if seq was odd or changed meanwhile. Readers never block the
+// writer.
+//
+#define SHM_MAGIC       0x4d454d54        // 'MEMT'
+#define SHM_VERSION     2
+
+//
+// shared statistics
+//
+//   magic,
+//   version    SHM_MAGIC and SHM_VERSION; the layout depends on the version
+//   seq        sequence number, odd while an update is in progress
+//   pid        process id of the traced process
+//   done       1 once the traced process has published its final values
+//   ns         time of the update since the start of the process in
+//              nanoseconds
+//   sample     mean sampling interval in bytes (0: every call is traced)
+//   live_bytes,
+//   live_blocks  bytes and blocks currently allocated
+//   peak_bytes,
+//   peak_blocks  maximum of live_bytes/live_blocks so far
+//   st         call counters and histograms (see memshard.h)
+//
+typedef struct __shm_stats {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  int pid;
+  int done;
+  uint64_t ns;
+  unsigned long sample;
+  unsigned long live_bytes;
+  unsigned long live_blocks;
+  unsigned long peak_bytes;
+  unsigned long peak_blocks;
+  stats st;
+} shm_stats;
+
+//
+// create the shared file and map it for writing
+//
+//   path       file name, e.g., /dev/shm/memtrace.<pid>
+//
+// returns
+//    shm_stats*  pointer to the mapped statistics or NULL on error
+//
+shm_stats *shm_create(const char *path);
+
+//
+// publish a snapshot
+//
+//   shm        mapped statistics returned by shm_create()
+//   snap       new values; magic, version and seq are ignored
+//
+// must be called from one thread at a time
+//
+void shm_publish(shm_stats *shm, const shm_stats *snap);
+
+//
+// map an existing file for reading
+//
+//   path       file name
+//
+// returns
+//    shm_stats*  pointer to the mapped statistics or NULL on error (errno
+//              is EINVAL if the file is not a memtrace statistics file)
+//
+const shm_stats *shm_attach(const char *path);
+
+//
+// take a consistent snapshot
+//
+//   shm        mapped statistics returned by shm_attach()
+//   snap       copy to fill in
+//
+// returns 0 on success, -1 if no consistent copy could be made because the
+// writer kept updating the page
+//
+int shm_read(const shm_stats *shm, shm_stats *snap);
+
+//
+// unmap the statistics
+//
+void shm_unmap(const shm_stats *shm);
+
+#endif
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memsite.h"
+#include "mempool.h"
+
+//
+// slot array and site table; same layout, memory and concurrency rules as
+// the block table in memlist.c (single writer, lock-free readers, replaced
+// slot arrays are kept until free_sites()). Sites are allocated from a
+// pool with room for SITE_MAX_DEPTH frames.
+//
+typedef struct __site_slots {
+  struct __site_slots *prev;
+  size_t mask;
+  site *slot[];
+} site_slots;
+
+typedef struct __site_table {
+  site head;
+  site *tail;
+  site_slots *cur;
+  size_t used;
+  pool sites;
+} site_table;
+
+#define SITES_MIN_SLOTS   256
+
+static inline site_table *to_table(site *list)
+{
+  return (site_table*)list;
+}
+
+static uint64_t hash(void **pc, int depth)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  int i;
+
+  for (i = 0; i < depth; i++) {
+    h = (h ^ (uintptr_t)pc[i]) * 0x100000001b3ULL;
+  }
+
+  return h ^ (h >> 29);
+}
+
+static inline int same(site *s, uint64_t h, void **pc, int depth)
+{
+  return (s->hash == h) && (s->depth == depth) &&
+         (memcmp(s->pc, pc, depth * sizeof(void*)) == 0);
+}
+
+static site **probe(site_slots *t, uint64_t h, void **pc, int depth)
+{
+  size_t i = h & t->mask;
+  site *cur;
+
+  while (((cur = __atomic_load_n(&t->slot[i], __ATOMIC_ACQUIRE)) != NULL) &&
+         !same(cur, h, pc, depth)) {
+    i = (i + 1) & t->mask;
+  }
+
+  return &t->slot[i];
+}
+
+static inline size_t slots_size(size_t n)
+{
+  return sizeof(site_slots) + n * sizeof(site*);
+}
+
+static site_slots *new_slots(size_t n)
+{
+  site_slots *t = meta_map(slots_size(n));
+
+  if (t != NULL) t->mask = n - 1;
+  return t;
+}
+
+static int grow(site_table *t)
+{
+  site_slots *n;
+  site *s;
+
+  n = new_slots((t->cur->mask + 1) << 1);
+  if (n == NULL) return -1;
+
+  for (s = t->head.next; s != NULL; s = s->next) {
+    *probe(n, s->hash, s->pc, s->depth) = s;
+  }
+
+  n->prev = t->cur;
+  __atomic_store_n(&t->cur, n, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+site *new_sites(void)
+{
+  site_table *t;
+
+  t = meta_map(sizeof(site_table));
+  if (t == NULL) return NULL;
+
+  t->cur = new_slots(SITES_MIN_SLOTS);
+  if (t->cur == NULL) {
+    meta_unmap(t, sizeof(site_table));
+    return NULL;
+  }
+  t->tail = &t->head;
+  pool_init(&t->sites, sizeof(site) + SITE_MAX_DEPTH * sizeof(void*));
+
+  return &t->head;
+}
+
+void free_sites(site *list)
+{
+  site_table *t;
+  site_slots *n, *prev;
+
+  if (list == NULL) return;
+
+  t = to_table(list);
+  pool_release(&t->sites);
+
+  for (n = t->cur; n != NULL; n = prev) {
+    prev = n->prev;
+    meta_unmap(n, slots_size(n->mask + 1));
+  }
+  meta_unmap(t, sizeof(site_table));
+}
+
+site *get_site(site *list, void **pc, int depth)
+{
+  site_table *t;
+  site **slot, *s;
+  uint64_t h;
+
+  if (list == NULL) return NULL;
+  if (depth > SITE_MAX_DEPTH) depth = SITE_MAX_DEPTH;
+
+  t = to_table(list);
+  h = hash(pc, depth);
+
+  slot = probe(t->cur, h, pc, depth);
+  if (*slot != NULL) return *slot;
+
+  s = pool_alloc(&t->sites);
+  if (s == NULL) return NULL;
+  s->hash = h;
+  s->depth = depth;
+  memcpy(s->pc, pc, depth * sizeof(void*));
+
+  __atomic_store_n(slot, s, __ATOMIC_RELEASE);
+  __atomic_store_n(&t->tail->next, s, __ATOMIC_RELEASE);
+  t->tail = s;
+
+  if (++t->used * 2 > t->cur->mask + 1) grow(t);
+
+  return s;
+}
+
+void merge_site(site *list, site *s)
+{
+  site *m = get_site(list, s->pc, s->depth);
+
+  if (m == NULL) return;
+
+  if (s->n_alloc > 0) {
+    if ((m->n_alloc == 0) || (s->min_size < m->min_size)) m->min_size = s->min_size;
+    if (s->max_size > m->max_size) m->max_size = s->max_size;
+  }
+  m->n_alloc  += __atomic_load_n(&s->n_alloc, __ATOMIC_RELAXED);
+  m->n_allocb += __atomic_load_n(&s->n_allocb, __ATOMIC_RELAXED);
+  m->n_free   += __atomic_load_n(&s->n_free, __ATOMIC_RELAXED);
+  m->n_freeb  += __atomic_load_n(&s->n_freeb, __ATOMIC_RELAXED);
+  m->n_remote += __atomic_load_n(&s->n_remote, __ATOMIC_RELAXED);
+  m->n_remoteb += __atomic_load_n(&s->n_remoteb, __ATOMIC_RELAXED);
+  m->n_ephemeral += __atomic_load_n(&s->n_ephemeral, __ATOMIC_RELAXED);
+  m->n_chains += __atomic_load_n(&s->n_chains, __ATOMIC_RELAXED);
+  m->n_grows  += __atomic_load_n(&s->n_grows, __ATOMIC_RELAXED);
+  m->n_copied += __atomic_load_n(&s->n_copied, __ATOMIC_RELAXED);
+  site_max(&m->max_first, __atomic_load_n(&s->max_first, __ATOMIC_RELAXED));
+  site_max(&m->max_final, __atomic_load_n(&s->max_final, __ATOMIC_RELAXED));
+  if (s->origin != NULL) m->origin = s->origin;
+}
+
+char *site_name(void *pc, char *buf, size_t len)
+{
+  Dl_info info;
+  const char *module;
+
+  if ((dladdr(pc, &info) == 0) || (info.dli_fname == NULL)) {
+    snprintf(buf, len, "%p", pc);
+    return buf;
+  }
+
+  module = strrchr(info.dli_fname, '/');
+  module = module ? module + 1 : info.dli_fname;
+
+  if (info.dli_sname != NULL) {
+    snprintf(buf, len, "%s+0x%lx (%s)", info.dli_sname,
+             (unsigned long)((char*)pc - (char*)info.dli_saddr), module);
+  } else {
+    snprintf(buf, len, "%s+0x%lx", module,
+             (unsigned long)((char*)pc - (char*)info.dli_fbase));
+  }
+
+  return buf;
+}
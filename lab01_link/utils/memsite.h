@@ -0,0 +1,200 @@
+#ifndef __MEMSITE_H__
+#define __MEMSITE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// maximum number of frames recorded per call site
+//
+#define SITE_MAX_DEPTH  16
+
+//
+// list element holding the allocation statistics of one call site
+//
+//   hash       hash of pc[0..depth-1]
+//   depth      number of frames
+//   n_alloc    number of blocks allocated from this site
+//   n_allocb   number of bytes allocated from this site
+//   n_free     number of those blocks that were freed
+//   n_freeb    number of those bytes that were freed
+//   n_remote   number of those blocks that were freed by another thread
+//   n_remoteb  number of those bytes that were freed by another thread
+//   n_ephemeral  number of those blocks that were short-lived (see
+//              site_ephemeral())
+//   min_size,
+//   max_size   smallest and largest requested size of the blocks
+//
+//   n_chains   number of realloc chains that ended at a block of this site
+//              (the site of the last realloc of the chain)
+//   n_grows    number of reallocs in those chains
+//   n_copied   number of bytes those reallocs copied (the old size of every
+//              realloc that moved the block)
+//   max_first  largest initial size of those chains
+//   max_final  largest final size of those chains
+//   origin     call site that started the last of those chains
+//
+//   next       pointer to next site in linked list
+//   pc         return addresses, innermost (the caller of malloc) first
+//
+// n_alloc, n_allocb, min_size and max_size are only updated by the thread
+// owning the list; n_free, n_freeb, n_remote, n_remoteb, n_ephemeral and the
+// chain statistics are updated atomically by whichever thread frees a block.
+//
+typedef struct __site {
+  uint64_t hash;
+  int depth;
+  unsigned long n_alloc;
+  unsigned long n_allocb;
+  unsigned long n_free;
+  unsigned long n_freeb;
+  unsigned long n_remote;
+  unsigned long n_remoteb;
+  unsigned long n_ephemeral;
+  unsigned long min_size;
+  unsigned long max_size;
+  unsigned long n_chains;
+  unsigned long n_grows;
+  unsigned long n_copied;
+  unsigned long max_first;
+  unsigned long max_final;
+  struct __site *origin;
+  struct __site *next;
+  void *pc[];
+} site;
+
+
+//
+// initialize a new site list.
+// The first element is a dummy element
+//
+// like the block list (see memlist.h), sites are indexed by a hash table
+// and chained in insertion order.
+//
+site *new_sites(void);
+
+//
+// free a site list
+//
+void free_sites(site *list);
+
+//
+// get the site with the given frames, adding it if it does not exist yet
+//
+//   list       pointer to site list
+//   pc         return addresses
+//   depth      number of return addresses
+//
+// returns
+//    site*     pointer to the site or NULL if it could not be created
+//
+// must only be called by the thread owning the list
+//
+site *get_site(site *list, void **pc, int depth);
+
+//
+// account blocks allocated from / freed to a site
+//
+//   s          pointer to site (may be NULL)
+//   n          number of blocks (1, or an estimate in sampling mode)
+//   size       number of bytes
+//
+static inline void site_alloc(site *s, unsigned long n, size_t size)
+{
+  if (s == NULL) return;
+  s->n_alloc += n;
+  s->n_allocb += size;
+}
+
+static inline void site_free(site *s, unsigned long n, size_t size)
+{
+  if (s == NULL) return;
+  __atomic_fetch_add(&s->n_free, n, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->n_freeb, size, __ATOMIC_RELAXED);
+}
+
+static inline void site_remote(site *s, unsigned long n, size_t size)
+{
+  if (s == NULL) return;
+  __atomic_fetch_add(&s->n_remote, n, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->n_remoteb, size, __ATOMIC_RELAXED);
+}
+
+//
+// account the requested size of a block allocated from a site. Must be called
+// before site_alloc() for the block.
+//
+//   s          pointer to site (may be NULL)
+//   size       requested size
+//
+static inline void site_size(site *s, size_t size)
+{
+  if (s == NULL) return;
+  if ((s->n_alloc == 0) || (size < s->min_size)) s->min_size = size;
+  if (size > s->max_size) s->max_size = size;
+}
+
+//
+// account freed blocks of a site that were short-lived enough to have been
+// served by a pool (a freelist or an arena) instead of the allocator
+//
+//   s          pointer to site (may be NULL)
+//   n          number of blocks
+//
+static inline void site_ephemeral(site *s, unsigned long n)
+{
+  if (s == NULL) return;
+  __atomic_fetch_add(&s->n_ephemeral, n, __ATOMIC_RELAXED);
+}
+
+static inline void site_max(unsigned long *max, unsigned long v)
+{
+  unsigned long m = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+  while ((v > m) && !__atomic_compare_exchange_n(max, &m, v, 1, __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED));
+}
+
+//
+// account a realloc chain that ended (the block was freed or the program
+// exits) at a block of this site
+//
+//   s          pointer to site (may be NULL)
+//   grows      number of reallocs in the chain
+//   copied     bytes copied by the chain
+//   first,
+//   final      initial and final size of the chain
+//   origin     call site that started the chain
+//
+static inline void site_chain(site *s, unsigned long grows, unsigned long copied,
+                              unsigned long first, unsigned long final,
+                              site *origin)
+{
+  if (s == NULL) return;
+  __atomic_fetch_add(&s->n_chains, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->n_grows, grows, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->n_copied, copied, __ATOMIC_RELAXED);
+  site_max(&s->max_first, first);
+  site_max(&s->max_final, final);
+  __atomic_store_n(&s->origin, origin, __ATOMIC_RELAXED);
+}
+
+//
+// add the statistics of a site to the site with the same frames in list
+//
+//   list       pointer to site list
+//   s          site to merge
+//
+void merge_site(site *list, site *s);
+
+//
+// format a return address as 'symbol+offset (module)' using dladdr
+//
+//   pc         return address
+//   buf, len   output buffer
+//
+// returns buf
+//
+char *site_name(void *pc, char *buf, size_t len);
+
+#endif
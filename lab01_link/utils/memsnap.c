@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "memshard.h"
+#include "memsnap.h"
+
+//
+// sites are written in order of decreasing live bytes
+//
+static int by_live(const void *a, const void *b)
+{
+  const site *x = *(const site**)a, *y = *(const site**)b;
+
+  if (x->n_allocb != y->n_allocb) return x->n_allocb < y->n_allocb ? 1 : -1;
+  return 0;
+}
+
+//
+// the live blocks are accounted to a fresh site table with the frames of
+// their call site; blocks without a call site go to a site without frames
+//
+static site *live_site(site *live, item *i)
+{
+  return i->site ? get_site(live, i->site->pc, i->site->depth)
+                 : get_site(live, NULL, 0);
+}
+
+int snap_write(const char *path, uint64_t ns)
+{
+  FILE *f;
+  site *live, *s, **sorted;
+  shard *sh;
+  item *i;
+  unsigned long bytes = 0, blocks = 0;
+  size_t n = 0, k;
+  char name[256];
+  int d, cnt;
+
+  live = new_sites();
+  if (live == NULL) return -1;
+
+  for (sh = shard_first(); sh != NULL; sh = sh->next) {
+    for (i = sh->list->next; i != NULL; i = __atomic_load_n(&i->next, __ATOMIC_ACQUIRE)) {
+      if (__atomic_load_n(&i->cnt, __ATOMIC_ACQUIRE) <= 0) continue;
+
+      s = live_site(live, i);
+      if (s == NULL) continue;
+      if (s->n_alloc == 0) n++;
+      site_alloc(s, 1, i->size);
+      bytes += i->size;
+      blocks++;
+    }
+  }
+
+  sorted = malloc((n + 1) * sizeof(site*));
+  f = fopen(path, "we");
+  if ((sorted == NULL) || (f == NULL)) {
+    free(sorted);
+    if (f != NULL) fclose(f);
+    free_sites(live);
+    return -1;
+  }
+
+  for (s = live->next, k = 0; (s != NULL) && (k < n); s = s->next) {
+    if (s->n_alloc > 0) sorted[k++] = s;
+  }
+  n = k;
+  qsort(sorted, n, sizeof(site*), by_live);
+
+  fprintf(f, "memtrace snapshot %d\n", SNAP_VERSION);
+  fprintf(f, "pid %d\n", (int)getpid());
+  fprintf(f, "time_ns %lu\n", (unsigned long)ns);
+  fprintf(f, "live_bytes %lu\n", bytes);
+  fprintf(f, "live_blocks %lu\n", blocks);
+
+  for (k = 0; k < n; k++) {
+    s = sorted[k];
+    fprintf(f, "site %lx %lu %lu\n", (unsigned long)s->hash, s->n_alloc,
+            s->n_allocb);
+    for (d = 0; d < s->depth; d++) {
+      fprintf(f, "frame %s\n", site_name(s->pc[d], name, sizeof(name)));
+    }
+  }
+
+  // blocks allocated since the first walk are not listed under any site
+  for (sh = shard_first(); sh != NULL; sh = sh->next) {
+    for (i = sh->list->next; i != NULL; i = __atomic_load_n(&i->next, __ATOMIC_ACQUIRE)) {
+      if ((cnt = __atomic_load_n(&i->cnt, __ATOMIC_ACQUIRE)) <= 0) continue;
+
+      s = live_site(live, i);
+      if ((s == NULL) || (s->n_alloc == 0)) continue;
+      fprintf(f, "block %p %zu %d %lx\n", i->ptr, i->size, cnt,
+              (unsigned long)s->hash);
+    }
+  }
+
+  free(sorted);
+  free_sites(live);
+
+  return fclose(f) == 0 ? 0 : -1;
+}
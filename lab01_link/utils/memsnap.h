@@ -0,0 +1,43 @@
+#ifndef __MEMSNAP_H__
+#define __MEMSNAP_H__
+
+#include <stdint.h>
+
+//
+// heap snapshots
+//
+// A snapshot lists the live blocks of all shards at one point in time,
+// grouped by call site, as a text file:
+//
+//   memtrace snapshot 1
+//   pid <pid>
+//   time_ns <ns since the start of the process>
+//   live_bytes <bytes>
+//   live_blocks <blocks>
+//   site <id> <blocks> <bytes>          one per call site with live blocks
+//   frame <symbol+offset (module)>      depth lines, innermost first
+//   ...
+//   block <ptr> <size> <refs> <site id>   one per live block
+//   ...
+//
+// Site ids only link the block lines to the site lines of the same file.
+// Snapshots of different runs are compared by the frame names (see
+// memtrace-snapdiff).
+//
+#define SNAP_VERSION    1
+
+//
+// write a snapshot of the live blocks
+//
+//   path       file name
+//   ns         time since the start of the process in nanoseconds
+//
+// returns 0 on success, -1 on error
+//
+// may be called while other threads allocate and free blocks: the block
+// tables are only read. Blocks allocated or freed during the walk may or may
+// not be included. The caller must not be traced (the function allocates).
+//
+int snap_write(const char *path, uint64_t ns);
+
+#endif
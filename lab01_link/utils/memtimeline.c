@@ -0,0 +1,65 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memtimeline.h"
+
+//
+// output file and format
+//
+static FILE *out = NULL;
+static bool chrome = false;
+static bool first = true;
+
+int timeline_open(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+
+  out = fopen(path, "we");
+  if (out == NULL) return -1;
+
+  chrome = (ext != NULL) && (strcmp(ext, ".json") == 0);
+  first = true;
+
+  if (chrome) fprintf(out, "{\"traceEvents\":[\n");
+  else fprintf(out, "time_ns,live_bytes,live_blocks,peak_bytes\n");
+
+  return 0;
+}
+
+void timeline_sample(uint64_t ns, unsigned long bytes, unsigned long blocks,
+                     unsigned long peak)
+{
+  if (out == NULL) return;
+
+  if (!chrome) {
+    fprintf(out, "%lu,%lu,%lu,%lu\n", (unsigned long)ns, bytes, blocks, peak);
+    return;
+  }
+
+  // timestamps of the trace event format are in microseconds
+  fprintf(out, "%s{\"name\":\"heap\",\"ph\":\"C\",\"pid\":%d,\"ts\":%lu.%03lu,"
+               "\"args\":{\"live bytes\":%lu,\"live blocks\":%lu,"
+               "\"peak bytes\":%lu}}",
+          first ? "" : ",\n", (int)getpid(), (unsigned long)(ns / 1000),
+          (unsigned long)(ns % 1000), bytes, blocks, peak);
+  first = false;
+}
+
+void timeline_detach(void)
+{
+  out = NULL;
+}
+
+void timeline_close(void)
+{
+  if (out == NULL) return;
+
+  if (chrome) fprintf(out, "\n]}\n");
+
+  fclose(out);
+  out = NULL;
+}
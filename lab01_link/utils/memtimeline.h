@@ -0,0 +1,52 @@
+#ifndef __MEMTIMELINE_H__
+#define __MEMTIMELINE_H__
+
+#include <stdint.h>
+
+//
+// heap-over-time timeline
+//
+// The live heap is sampled periodically and written to a file, either as
+//
+//   CSV            one line 'time_ns,live_bytes,live_blocks,peak_bytes' per
+//                  sample after a header line
+//   Chrome trace   counter events ("ph": "C") in the trace event format,
+//                  viewable in chrome://tracing or Perfetto
+//
+// The format is chosen by the extension of the file name: '.json' selects
+// the Chrome trace format, anything else CSV.
+//
+// All functions must be called from one thread at a time.
+//
+
+//
+// open the timeline file
+//
+//   path       file name
+//
+// returns 0 on success, -1 on error
+//
+int timeline_open(const char *path);
+
+//
+// append a sample
+//
+//   ns         time since the start of the program in nanoseconds
+//   bytes      number of live bytes
+//   blocks     number of live blocks
+//   peak       peak number of live bytes so far
+//
+void timeline_sample(uint64_t ns, unsigned long bytes, unsigned long blocks,
+                     unsigned long peak);
+
+//
+// forget the timeline without writing to it (child after fork())
+//
+void timeline_detach(void);
+
+//
+// complete and close the timeline file
+//
+void timeline_close(void);
+
+#endif